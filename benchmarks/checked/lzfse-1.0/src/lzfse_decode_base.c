@@ -153,6 +153,13 @@ static inline void copy(uint8_t *dst, const uint8_t *src, size_t length) {
   } while (dst < dst_end);
 }
 
+//  Copy a match of length bytes at distance D byte by byte, for a distance
+//  too short for copy().
+static inline void copy_overlapping(uint8_t *dst, int32_t D, size_t length) {
+  for (size_t i = 0; i < length; i++)
+    dst[i] = dst[i - D];
+}
+
 static int lzfse_decode_lmd(mm_ptr<lzfse_decoder_state> s) {
   mm_ptr<lzfse_compressed_block_decoder_state> bs = &(s->compressed_lzfse_block_state);
   fse_state l_state = bs->l_state;
@@ -179,6 +186,13 @@ static int lzfse_decode_lmd(mm_ptr<lzfse_decoder_state> s) {
   //  in the slow-and-careful match execution path.
   ptrdiff_t remaining_bytes = s->dst_end - dst - 32;
 
+  //  Nothing frees the destination buffer or the block state while a block
+  //  is decoded, so check dst and lit once here. The copies below go through
+  //  the raw pointers that the checks return, which move along with dst and
+  //  lit.
+  uint8_t *dst_raw = MM_ARRAY_CHECKED(uint8_t, dst);
+  const uint8_t *lit_raw = MM_ARRAY_CHECKED(const uint8_t, lit);
+
   //  If L or M is non-zero, that means that we have already started decoding
   //  this block, and that we needed to interrupt decoding to get more space
   //  from the caller.  There's a pending L, M, D triplet that we weren't
@@ -230,20 +244,22 @@ static int lzfse_decode_lmd(mm_ptr<lzfse_decoder_state> s) {
       //  and match with 16- and 32-byte operations, without worrying
       //  about writing off the end of the buffer.
       remaining_bytes -= L + M;
-      copy(_GETARRAYPTR(uint8_t, dst), _GETARRAYPTR(uint8_t, lit), L);
+      copy(dst_raw, lit_raw, L);
       dst += L;
+      dst_raw += L;
       lit += L;
+      lit_raw += L;
       //  For the match, we have two paths; a fast copy by 16-bytes if
       //  the match distance is large enough to allow it, and a more
       //  careful path that applies a permutation to account for the
       //  possible overlap between source and destination if the distance
       //  is small.
       if (D >= 8 || D >= M)
-        copy(_GETARRAYPTR(uint8_t, dst), _GETARRAYPTR(uint8_t, dst - D), M);
+        copy(dst_raw, dst_raw - D, M);
       else
-        for (size_t i = 0; i < M; i++)
-          dst[i] = dst[i - D];
+        copy_overlapping(dst_raw, D, M);
       dst += M;
+      dst_raw += M;
     }
 
     else {
@@ -257,10 +273,11 @@ static int lzfse_decode_lmd(mm_ptr<lzfse_decoder_state> s) {
       //  or there isn't; if there is, we copy the whole thing and
       //  update all the pointers and lengths to reflect the copy.
       if (L <= remaining_bytes) {
-        for (size_t i = 0; i < L; i++)
-          dst[i] = lit[i];
+        memcpy(dst_raw, lit_raw, L);
         dst += L;
+        dst_raw += L;
         lit += L;
+        lit_raw += L;
         remaining_bytes -= L;
         L = 0;
       }
@@ -269,10 +286,11 @@ static int lzfse_decode_lmd(mm_ptr<lzfse_decoder_state> s) {
       //  L, and report that the destination buffer is full. Note that
       //  we always write right up to the end of the destination buffer.
       else {
-        for (size_t i = 0; i < remaining_bytes; i++)
-          dst[i] = lit[i];
+        memcpy(dst_raw, lit_raw, remaining_bytes);
         dst += remaining_bytes;
+        dst_raw += remaining_bytes;
         lit += remaining_bytes;
+        lit_raw += remaining_bytes;
         L -= remaining_bytes;
         goto DestinationBufferIsFull;
       }
@@ -281,9 +299,9 @@ static int lzfse_decode_lmd(mm_ptr<lzfse_decoder_state> s) {
       //  before finishing, we return to the caller indicating that
       //  the buffer is full.
       if (M <= remaining_bytes) {
-        for (size_t i = 0; i < M; i++)
-          dst[i] = dst[i - D];
+        copy_overlapping(dst_raw, D, M);
         dst += M;
+        dst_raw += M;
         remaining_bytes -= M;
         M = 0;
         (void)M; // no dead store warning
@@ -295,9 +313,9 @@ static int lzfse_decode_lmd(mm_ptr<lzfse_decoder_state> s) {
                  //
                  // But we still set M = 0, to maintain the post-condition.
       } else {
-        for (size_t i = 0; i < remaining_bytes; i++)
-          dst[i] = dst[i - D];
+        copy_overlapping(dst_raw, D, remaining_bytes);
         dst += remaining_bytes;
+        dst_raw += remaining_bytes;
         M -= remaining_bytes;
       DestinationBufferIsFull:
         //  Because we want to be able to resume decoding where we've left
@@ -660,38 +660,46 @@ static mm_array_ptr<char> process_string(mm_array_ptr<const char> input, size_t
     if (output == NULL) {
         goto error;
     }
-    output_ptr = output;
-    while ((*input_ptr != '\0') && (size_t)(input_ptr - input) < input_len) {
-        if (*input_ptr == '\\') {
-            input_ptr++;
-            switch (*input_ptr) {
-                case '\"': *output_ptr = '\"'; break;
-                case '\\': *output_ptr = '\\'; break;
-                case '/':  *output_ptr = '/';  break;
-                case 'b':  *output_ptr = '\b'; break;
-                case 'f':  *output_ptr = '\f'; break;
-                case 'n':  *output_ptr = '\n'; break;
-                case 'r':  *output_ptr = '\r'; break;
-                case 't':  *output_ptr = '\t'; break;
+    /* Nothing frees input or output in the loop, so check them once and
+       walk their raw pointers. */
+    const char *in = MM_ARRAY_CHECKED(const char, input);
+    const char *in_end = in + input_len;
+    char *out = MM_ARRAY_CHECKED(char, output);
+    while ((*in != '\0') && in < in_end) {
+        if (*in == '\\') {
+            in++;
+            switch (*in) {
+                case '\"': *out = '\"'; break;
+                case '\\': *out = '\\'; break;
+                case '/':  *out = '/';  break;
+                case 'b':  *out = '\b'; break;
+                case 'f':  *out = '\f'; break;
+                case 'n':  *out = '\n'; break;
+                case 'r':  *out = '\r'; break;
+                case 't':  *out = '\t'; break;
                 case 'u':
+                    input_ptr = _create_mm_array_ptr<const char>(input, (char *)in);
+                    output_ptr = _create_mm_array_ptr<char>(output, out);
                     if (parse_utf16(&input_ptr, &output_ptr) == JSONFailure) {
                         goto error;
                     }
+                    in = _GETARRAYPTR(const char, input_ptr);
+                    out = _GETARRAYPTR(char, output_ptr);
                     break;
                 default:
                     goto error;
             }
-        } else if ((unsigned char)*input_ptr < 0x20) {
+        } else if ((unsigned char)*in < 0x20) {
             goto error; /* 0x00-0x19 are invalid characters for json string (http://www.ietf.org/rfc/rfc4627.txt) */
         } else {
-            *output_ptr = *input_ptr;
+            *out = *in;
         }
-        output_ptr++;
-        input_ptr++;
+        out++;
+        in++;
     }
-    *output_ptr = '\0';
+    *out = '\0';
     /* resize to new length */
-    final_size = (size_t)(output_ptr-output) + 1;
+    final_size = (size_t)(out - _GETARRAYPTR(char, output)) + 1;
     /* todo: don't resize if final_size == initial_size */
     resized_output = MM_ARRAY_ALLOC(char, final_size);
     if (resized_output == NULL) {
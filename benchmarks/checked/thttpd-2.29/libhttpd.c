@@ -3398,6 +3398,7 @@ cgi_child( mm_ptr<httpd_conn> hc )
     mm_array_ptr<mm_array_ptr<char>> envp = NULL;
     mm_array_ptr<char> binary = NULL;
     mm_array_ptr<char> directory = NULL;
+    void* raw_envp[50];
 
     /* Unset close-on-exec flag for this socket.  This actually shouldn't
     ** be necessary, according to POSIX a dup()'d file descriptor does
@@ -3577,9 +3578,13 @@ cgi_child( mm_ptr<httpd_conn> hc )
     (void) signal( SIGPIPE, SIG_DFL );
 #endif /* HAVE_SIGSET */
 
-    /* Run the program. */
-    (void) execve( _GETCHARPTR(binary), (char *const *)_marshal_shared_array_ptr<char>(argp),
-            (char *const*)_marshal_shared_array_ptr<char>(envp));
+    /* Run the program.  make_envp() fills at most 50 slots, so the raw
+    ** environment fits on the stack; the arguments go into the per-thread
+    ** scratch buffer, which only one of the two can use.
+    */
+    (void) execve( _GETCHARPTR(binary),
+            (char *const *)_marshal_shared_array_ptr_to<char>(argp, NULL, 0),
+            (char *const *)_marshal_shared_array_ptr_to<char>(envp, raw_envp, 50));
 
     /* Something went wrong. */
     syslog( LOG_ERR, "execve %.80s - %m", _GETARRAYPTR(char, hc->expnfilename));
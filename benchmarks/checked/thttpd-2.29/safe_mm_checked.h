@@ -22,8 +22,9 @@
 #define MM_ARRAY_ALLOC(T, n) mm_array_alloc<T>(sizeof(T) * n)
 #define MM_FREE(T, p) mm_free<T>(p)
 #define MM_ARRAY_FREE(T, p) mm_array_free<T>(p)
-#define MM_CHECKED(T, p) mm_checked<T>(p);
-#define MM_ARRAY_CHECKED(T, p) mmarray_checked<T>(p);
+/* Check p once and get its raw pointer for a loop (see mm_checked()). */
+#define MM_CHECKED(T, p) ((T *)mm_checked<T>(p))
+#define MM_ARRAY_CHECKED(T, p) ((T *)mmarray_checked<T>(p))
 
 for_any(T) mm_ptr<T> mm_alloc(size_t size);
 for_any(T) void mm_free(mm_ptr<const T> const p);
@@ -48,10 +49,14 @@ for_any(T) mm_ptr<T> mmarrayptr_to_mmptr(mm_array_ptr<T> p);
 for_any(T) void _setptr_mm_array(mm_array_ptr<T> *p, char *new_p);
 for_any(T) mm_array_ptr<T> _create_mm_array_ptr(mm_array_ptr<T> p, char *new_p);
 
-/* Mark a checked pointer to be valid */
-for_any(T) void mm_checked(mm_ptr<T> p);
-for_any(T) void mmarray_checked(mm_array_ptr<T> p);
+/* Check once that p points to a live object and return its raw pointer, or
+ * abort if the object has been freed. NULL gives NULL. */
+for_any(T) void *mm_checked(mm_ptr<T> p);
+for_any(T) void *mmarray_checked(mm_array_ptr<T> p);
 
 /* Marshaling an array of mm_array_ptr to an array of raw pointers. */
 for_any(T) void **_marshal_shared_array_ptr(mm_array_ptr<mm_array_ptr<T>> p);
+/* The same, into buf or a per-thread scratch buffer if buf is NULL. */
+for_any(T) void **_marshal_shared_array_ptr_to(mm_array_ptr<mm_array_ptr<T>> p,
+                                               void **buf, size_t cap);
 #endif
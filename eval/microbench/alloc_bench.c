@@ -0,0 +1,139 @@
+/**
+ * alloc_bench.c - Allocation throughput of libsafemm.
+ *
+ * The three workloads mimic the allocation patterns of the programs we
+ * evaluate: building and tearing down a tree of small structs (Olden),
+ * short-lived strings of various sizes (thttpd), and arrays that grow by
+ * realloc while a document is being built (parson).
+ *
+ * Link this file against different libsafemm variants (see the Makefile)
+ * to compare their backing allocators.
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "safe_mm_checked.h"
+
+#define NUM_NODES (1 << 20)
+#define NUM_STRS  (1 << 12)
+#define NUM_OPS   (1 << 23)
+#define NUM_ARRAYS (1 << 14)
+#define ROUNDS 8
+
+typedef struct tree_node {
+    long val;
+    mm_ptr<struct tree_node> left;
+    mm_ptr<struct tree_node> right;
+} TreeNode;
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+/* xorshift64 so that every run sees the same sequence of sizes. */
+static uint64_t next_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, unsigned long ops, double secs) {
+    printf("%-8s %10lu ops %8.3f s %8.2f Mops/s %8.2f ns/op\n",
+           name, ops, secs, ops / secs / 1e6, secs * 1e9 / ops);
+}
+
+/*
+ * Allocate NUM_NODES tree nodes and free them all, ROUNDS times.
+ * */
+static void bench_tree(void) {
+    mm_array_ptr<mm_ptr<TreeNode>> nodes =
+        MM_ARRAY_ALLOC(mm_ptr<TreeNode>, NUM_NODES);
+
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < NUM_NODES; i++) {
+            mm_ptr<TreeNode> n = MM_ALLOC(TreeNode);
+            n->val = i;
+            nodes[i] = n;
+        }
+        for (int i = 0; i < NUM_NODES; i++) {
+            MM_FREE(TreeNode, nodes[i]);
+        }
+    }
+    report("tree", 2UL * ROUNDS * NUM_NODES, now() - start);
+
+    MM_ARRAY_FREE(mm_ptr<TreeNode>, nodes);
+}
+
+/*
+ * Keep NUM_STRS strings alive and replace a random one at each step with a
+ * string of a random size between 8 and 263 bytes.
+ * */
+static void bench_strings(void) {
+    mm_array_ptr<mm_array_ptr<char>> strs =
+        MM_ARRAY_ALLOC(mm_array_ptr<char>, NUM_STRS);
+    for (int i = 0; i < NUM_STRS; i++) {
+        strs[i] = MM_ARRAY_ALLOC(char, 8 + next_rand() % 256);
+    }
+
+    double start = now();
+    for (int i = 0; i < NUM_OPS; i++) {
+        unsigned idx = next_rand() % NUM_STRS;
+        size_t size = 8 + next_rand() % 256;
+        MM_ARRAY_FREE(char, strs[idx]);
+        strs[idx] = MM_ARRAY_ALLOC(char, size);
+        strs[idx][0] = (char)size;
+    }
+    report("strings", 2UL * NUM_OPS, now() - start);
+
+    for (int i = 0; i < NUM_STRS; i++) {
+        MM_ARRAY_FREE(char, strs[i]);
+    }
+    MM_ARRAY_FREE(mm_array_ptr<char>, strs);
+}
+
+/*
+ * Grow NUM_ARRAYS arrays from 16 bytes to 4 KB by doubling, then free them.
+ * */
+static void bench_realloc(void) {
+    mm_array_ptr<mm_array_ptr<char>> arrs =
+        MM_ARRAY_ALLOC(mm_array_ptr<char>, NUM_ARRAYS);
+    unsigned long ops = 0;
+
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < NUM_ARRAYS; i++) {
+            arrs[i] = MM_ARRAY_ALLOC(char, 16);
+            ops++;
+        }
+        for (size_t size = 32; size <= 4096; size *= 2) {
+            for (int i = 0; i < NUM_ARRAYS; i++) {
+                arrs[i] = MM_REALLOC(char, arrs[i], size);
+                arrs[i][size - 1] = 0;
+                ops++;
+            }
+        }
+        for (int i = 0; i < NUM_ARRAYS; i++) {
+            MM_ARRAY_FREE(char, arrs[i]);
+            ops++;
+        }
+    }
+    report("realloc", ops, now() - start);
+
+    MM_ARRAY_FREE(mm_array_ptr<char>, arrs);
+}
+
+int main(int argc, char *argv[]) {
+    printf("==== %s ====\n", argv[0]);
+    bench_tree();
+    bench_strings();
+    bench_realloc();
+    return 0;
+}
@@ -0,0 +1,146 @@
+/**
+ * checked_bench.c - Per-access key checks versus checking once per loop.
+ *
+ * Two loops from the checked benchmarks, each run over mmsafe pointers,
+ * where the compiler checks the key at every access, and over the raw
+ * pointers that MM_ARRAY_CHECKED() returns after checking the key once
+ * (see mm_checked() in safe_mm_checked.h):
+ *
+ * - unescape: the string copy of parson's process_string(), which copies
+ *   a JSON string byte by byte and turns escape sequences into characters.
+ * - match: the byte-by-byte match copy of lzfse's lzfse_decode_lmd(),
+ *   which copies bytes from a short distance back in the same buffer.
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "safe_mm_checked.h"
+
+#define STR_LEN (1 << 16)
+#define BUF_LEN (1 << 16)
+#define ROUNDS 2000
+/* Match distances of the match loop, all too short for a wide copy. */
+#define MAX_DIST 8
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char unescape_char(char c) {
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        default:  return c;
+    }
+}
+
+static size_t unescape_checked(mm_array_ptr<const char> in, size_t len,
+                               mm_array_ptr<char> out) {
+    size_t i = 0, o = 0;
+    while (i < len && in[i] != '\0') {
+        if (in[i] == '\\') {
+            i++;
+            out[o] = unescape_char(in[i]);
+        } else {
+            out[o] = in[i];
+        }
+        o++;
+        i++;
+    }
+    out[o] = '\0';
+    return o;
+}
+
+static size_t unescape_once(mm_array_ptr<const char> in_p, size_t len,
+                            mm_array_ptr<char> out_p) {
+    const char *in = MM_ARRAY_CHECKED(const char, in_p);
+    char *out = MM_ARRAY_CHECKED(char, out_p);
+    size_t i = 0, o = 0;
+    while (i < len && in[i] != '\0') {
+        if (in[i] == '\\') {
+            i++;
+            out[o] = unescape_char(in[i]);
+        } else {
+            out[o] = in[i];
+        }
+        o++;
+        i++;
+    }
+    out[o] = '\0';
+    return o;
+}
+
+static void match_checked(mm_array_ptr<uint8_t> dst, size_t len) {
+    for (size_t pos = MAX_DIST; pos < len; ) {
+        size_t d = 1 + pos % MAX_DIST, m = 3 + pos % 29;
+        if (m > len - pos) m = len - pos;
+        for (size_t i = 0; i < m; i++)
+            dst[pos + i] = dst[pos + i - d];
+        pos += m;
+    }
+}
+
+static void match_once(mm_array_ptr<uint8_t> dst_p, size_t len) {
+    uint8_t *dst = MM_ARRAY_CHECKED(uint8_t, dst_p);
+    for (size_t pos = MAX_DIST; pos < len; ) {
+        size_t d = 1 + pos % MAX_DIST, m = 3 + pos % 29;
+        if (m > len - pos) m = len - pos;
+        for (size_t i = 0; i < m; i++)
+            dst[pos + i] = dst[pos + i - d];
+        pos += m;
+    }
+}
+
+static void report(const char *name, double checked, double once,
+                   size_t bytes) {
+    printf("%-10s %10.3f %10.3f %8.2fx\n", name, checked * 1e9 / bytes,
+           once * 1e9 / bytes, checked / once);
+}
+
+int main(int argc, char *argv[]) {
+    mm_array_ptr<char> str = MM_ARRAY_ALLOC(char, STR_LEN + 1);
+    mm_array_ptr<char> out = MM_ARRAY_ALLOC(char, STR_LEN + 1);
+    mm_array_ptr<uint8_t> buf = MM_ARRAY_ALLOC(uint8_t, BUF_LEN);
+
+    // A JSON string with an escape sequence every 17 characters.
+    for (size_t i = 0; i < STR_LEN; i++) {
+        str[i] = i % 17 == 16 ? '\\' : 'a' + i % 26;
+    }
+    str[STR_LEN] = '\0';
+    for (size_t i = 0; i < MAX_DIST; i++) buf[i] = (uint8_t)i;
+
+    printf("==== %s ====\n", argv[0]);
+    printf("%-10s %10s %10s %9s\n", "loop", "checked", "once", "speedup");
+    printf("%-10s %10s %10s\n", "", "ns/byte", "ns/byte");
+
+    size_t n = 0;
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++) n += unescape_checked(str, STR_LEN, out);
+    double checked = now() - start;
+    start = now();
+    for (int r = 0; r < ROUNDS; r++) n -= unescape_once(str, STR_LEN, out);
+    double once = now() - start;
+    if (n != 0) {
+        fprintf(stderr, "The two unescape loops disagree\n");
+        return 1;
+    }
+    report("unescape", checked, once, (size_t)ROUNDS * STR_LEN);
+
+    start = now();
+    for (int r = 0; r < ROUNDS; r++) match_checked(buf, BUF_LEN);
+    checked = now() - start;
+    start = now();
+    for (int r = 0; r < ROUNDS; r++) match_once(buf, BUF_LEN);
+    once = now() - start;
+    report("match", checked, once, (size_t)ROUNDS * BUF_LEN);
+
+    MM_ARRAY_FREE(uint8_t, buf);
+    MM_ARRAY_FREE(char, out);
+    MM_ARRAY_FREE(char, str);
+    return 0;
+}
@@ -0,0 +1,93 @@
+/**
+ * free_latency_bench.c - Request latency with deferred release of frees.
+ *
+ * Every request allocates OBJS_PER_REQ objects the way thttpd handles a
+ * connection: mostly buffers of a few KB, some small structs, and now and
+ * then a buffer big enough for its own mapping. It writes to them and then
+ * frees them all. The latency percentiles of the requests are reported
+ * with frees released right away, released in batches by the freeing
+ * thread, and released in batches by a background thread (see
+ * mm_defer_free() in safe_mm_checked.h).
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "safe_mm_checked.h"
+
+#define REQUESTS 20000
+#define OBJS_PER_REQ 256
+#define DEFER_BATCH 256
+/* One request in BIG_EVERY allocates a buffer of BIG_SIZE bytes. */
+#define BIG_EVERY 16
+#define BIG_SIZE (3 << 19)
+
+static uint64_t rng_state = 88172645463325252ULL;
+
+/* xorshift64 so that every run sees the same sequence of sizes. */
+static uint64_t next_rand(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int by_value(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void request(mm_array_ptr<mm_array_ptr<char>> objs, int r) {
+    for (int i = 0; i < OBJS_PER_REQ; i++) {
+        uint64_t rand = next_rand();
+        size_t size = rand % 10 < 7 ? 600 + rand % 3500 : 16 + rand % 200;
+        if (i == 0 && r % BIG_EVERY == 0) size = BIG_SIZE;
+        objs[i] = MM_ARRAY_ALLOC(char, size);
+        memset(_GETCHARPTR(objs[i]), i, size < 256 ? size : 256);
+    }
+    for (int i = 0; i < OBJS_PER_REQ; i++) {
+        MM_ARRAY_FREE(char, objs[i]);
+    }
+}
+
+static void bench(const char *name, size_t batch, int background) {
+    mm_defer_free(batch, background);
+    mm_array_ptr<mm_array_ptr<char>> objs =
+        MM_ARRAY_ALLOC(mm_array_ptr<char>, OBJS_PER_REQ);
+    double *lat = malloc(REQUESTS * sizeof(double));
+
+    rng_state = 88172645463325252ULL;
+    double total = now();
+    for (int r = 0; r < REQUESTS; r++) {
+        double start = now();
+        request(objs, r);
+        lat[r] = (now() - start) * 1e6;
+    }
+    total = now() - total;
+
+    qsort(lat, REQUESTS, sizeof(double), by_value);
+    printf("%-12s p50 %7.1f  p90 %7.1f  p99 %7.1f  p99.9 %7.1f  max %8.1f us"
+           "  total %.3f s\n", name, lat[REQUESTS / 2],
+           lat[REQUESTS * 9 / 10], lat[REQUESTS * 99 / 100],
+           lat[REQUESTS * 999 / 1000], lat[REQUESTS - 1], total);
+
+    free(lat);
+    MM_ARRAY_FREE(mm_array_ptr<char>, objs);
+    mm_defer_free(0, 0);
+}
+
+int main(int argc, char *argv[]) {
+    printf("==== %s ====\n", argv[0]);
+    bench("immediate", 0, 0);
+    bench("batched", DEFER_BATCH, 0);
+    bench("background", DEFER_BATCH, 1);
+    return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * layout_bench.c - Cost of key checks and frees under a metadata layout.
+ *
+ * The metadata layout of mmsafe pointers (see include/mm_layout.h) is fixed
+ * at build time, so this benchmark is built once per layout (see the
+ * Makefile). It does not need the Checked C compiler: the key check that
+ * the compiler inserts before a dereference and the checks done by
+ * mm_array_free() are written out by hand on the same struct layout that
+ * the runtime uses.
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mm_layout.h"
+
+#define NUM_OBJS (1 << 14)
+#define OBJ_SIZE 64
+#define NUM_CHECKS (1 << 26)
+#define LOCK_MEM 8
+#define HEAP_PADDING 8
+
+#if defined(MM_LAYOUT_KO_32_32)
+#define LAYOUT_NAME "key-offset 32-32"
+#elif defined(MM_LAYOUT_KO_40_24)
+#define LAYOUT_NAME "key-offset 40-24"
+#elif defined(MM_LAYOUT_OK_32_32)
+#define LAYOUT_NAME "offset-key 32-32"
+#else
+#define LAYOUT_NAME "offset-key 24-40"
+#endif
+
+/* Same inner structure as an mmsafe pointer. */
+typedef struct {
+    char *p;
+    uint64_t key_offset;
+} MMPtr;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The check that the compiler inserts before dereferencing an mmsafe ptr. */
+static inline char checked_load(MMPtr ptr) {
+    char *lock = ptr.p - MM_GET_OFFSET(ptr.key_offset) - LOCK_MEM;
+    if (MM_GET_KEY(ptr.key_offset) != *(mm_key_t *)lock) __builtin_trap();
+    return *ptr.p;
+}
+
+/* The checks of mm_array_free() followed by the real free(). */
+static inline void checked_free(MMPtr ptr) {
+    if (MM_GET_OFFSET(ptr.key_offset) != 0) __builtin_trap();
+    char *lock = ptr.p - LOCK_MEM;
+    if (MM_GET_KEY(ptr.key_offset) != *(mm_key_t *)lock) __builtin_trap();
+    *(mm_key_t *)lock = 0;
+    free(lock - HEAP_PADDING);
+}
+
+int main(void) {
+    MMPtr *objs = malloc(sizeof(MMPtr) * NUM_OBJS);
+    MMPtr *inner = malloc(sizeof(MMPtr) * NUM_OBJS);
+    uint64_t key = 3;
+
+    for (unsigned i = 0; i < NUM_OBJS; i++) {
+        char *raw = malloc(OBJ_SIZE + HEAP_PADDING + LOCK_MEM);
+        *(mm_key_t *)(raw + HEAP_PADDING) = key;
+        objs[i].p = raw + HEAP_PADDING + LOCK_MEM;
+        objs[i].key_offset = MM_MAKE_KEY_OFFSET(key, 0);
+        // A pointer into the middle of the object, as after p + i.
+        unsigned offset = (i * 7) % OBJ_SIZE;
+        inner[i].p = objs[i].p + offset;
+        inner[i].key_offset = MM_ADD_OFFSET(objs[i].key_offset, offset);
+        key++;
+    }
+
+    uint64_t idx = 1;
+    unsigned sum = 0;
+    double start = now();
+    for (unsigned i = 0; i < NUM_CHECKS; i++) {
+        // An LCG walk so that the loads are not sequential. The objects fit
+        // in the L2 cache so that the cost of the check itself dominates.
+        idx = idx * 6364136223846793005ULL + 1442695040888963407ULL;
+        sum += checked_load(inner[(idx >> 32) % NUM_OBJS]);
+    }
+    double check_secs = now() - start;
+
+    start = now();
+    for (unsigned i = 0; i < NUM_OBJS; i++) {
+        checked_free(objs[i]);
+    }
+    double free_secs = now() - start;
+
+    printf("%-18s check: %6.2f ns/op   free: %6.2f ns/op   (%u)\n",
+           LAYOUT_NAME, check_secs * 1e9 / NUM_CHECKS,
+           free_secs * 1e9 / NUM_OBJS, sum & 1);
+
+    free(objs);
+    free(inner);
+    return 0;
+}
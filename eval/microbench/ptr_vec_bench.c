@@ -0,0 +1,133 @@
+/**
+ * ptr_vec_bench.c - Arrays of mmsafe pointers shared with unchecked code.
+ *
+ * An array of N string pointers (think of argv or envp for execve()) is
+ * kept in the interleaved layout, an mm_array_ptr of 16-byte mmsafe
+ * pointers, and in an mm_ptr_vec_t, with the raw pointers and the key and
+ * offset words in two arrays (see include/mm_ptr_vec.h). For each N, the
+ * benchmark reports:
+ *
+ * - the bytes that the array and its copy for unchecked code take;
+ * - the time to hand the array to unchecked code, which needs a copy by
+ *   _marshal_shared_array_ptr() (or _marshal_shared_array_ptr_to() into
+ *   the per-thread scratch buffer) for the interleaved layout, and none by
+ *   mm_ptr_vec_raw() for a vector;
+ * - the time to check every element with mm_ptr_vec_check(), which the
+ *   copies above do not do;
+ * - the time of a checked pass over all the elements.
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "safe_mm_checked.h"
+
+#define MAX_N (1 << 16)
+/* Element operations per measurement. */
+#define WORK (1 << 24)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Stand-in for the unchecked code that gets the array. The barrier keeps
+ * the compiler from hoisting calls on an unchanged array out of a loop. */
+static __attribute__((noinline)) size_t consume(void **raw) {
+    size_t n = 0;
+    __asm__ volatile("" ::: "memory");
+    while (raw[n] != NULL) n++;
+    return n;
+}
+
+static void bench(mm_array_ptr<mm_array_ptr<char>> strs, size_t n) {
+    size_t rounds = WORK / n;
+    size_t sink = 0;
+
+    // The interleaved layout, with a NULL at the end.
+    mm_array_ptr<mm_array_ptr<char>> arr =
+        MM_ARRAY_ALLOC(mm_array_ptr<char>, n + 1);
+    for (size_t i = 0; i < n; i++) arr[i] = strs[i];
+    arr[n] = NULL;
+
+    mm_ptr_vec_t vec;
+    mm_ptr_vec_init(&vec);
+    mm_ptr_vec_reserve(&vec, n);
+    for (size_t i = 0; i < n; i++) mm_ptr_vec_push<char>(&vec, strs[i]);
+
+    double start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        void **raw = _marshal_shared_array_ptr<char>(arr);
+        sink += consume(raw);
+        free(raw);
+    }
+    double marshal = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        sink += consume(_marshal_shared_array_ptr_to<char>(arr, NULL, 0));
+    }
+    double scratch = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        sink += consume(mm_ptr_vec_raw(&vec));
+    }
+    double shared = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        mm_ptr_vec_check(&vec);
+    }
+    double check = now() - start;
+
+    start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < n; i++) sink += arr[i][0];
+    }
+    double iter_arr = now() - start;
+
+    mm_array_ptr<char> s = NULL;
+    start = now();
+    for (size_t r = 0; r < rounds; r++) {
+        MM_PTR_VEC_FOREACH(char, &vec, i, s) sink += s[0];
+    }
+    double iter_vec = now() - start;
+
+    // Bytes for the array plus the copy that unchecked code gets.
+    size_t arr_bytes =
+        (n + 1) * (sizeof(mm_array_ptr<char>) + sizeof(void *));
+    size_t vec_bytes = vec.cap * (sizeof(void *) + sizeof(uint64_t));
+    double ops = (double)rounds * n;
+    printf("%8zu %10zu %10zu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", n,
+           arr_bytes, vec_bytes, marshal * 1e9 / ops, scratch * 1e9 / ops,
+           shared * 1e9 / ops, check * 1e9 / ops, iter_arr * 1e9 / ops,
+           iter_vec * 1e9 / ops);
+    if (sink == 0) printf("unreachable\n");
+
+    mm_ptr_vec_free(&vec);
+    MM_ARRAY_FREE(mm_array_ptr<char>, arr);
+}
+
+int main(int argc, char *argv[]) {
+    mm_array_ptr<mm_array_ptr<char>> strs =
+        MM_ARRAY_ALLOC(mm_array_ptr<char>, MAX_N);
+    for (size_t i = 0; i < MAX_N; i++) {
+        strs[i] = MM_ARRAY_ALLOC(char, 32);
+        mm_snprintf(strs[i], 32, "VAR%zu=value", i);
+    }
+
+    printf("==== %s ====\n", argv[0]);
+    printf("%8s %10s %10s %9s %9s %9s %9s %9s %9s\n", "", "bytes", "bytes",
+           "marshal", "scratch", "vec raw", "vec check", "iter", "iter");
+    printf("%8s %10s %10s %9s %9s %9s %9s %9s %9s\n", "elements",
+           "interleav", "vec", "ns/elem", "ns/elem", "ns/elem", "ns/elem",
+           "interleav", "vec");
+    for (size_t n = 16; n <= MAX_N; n *= 16) bench(strs, n);
+
+    for (size_t i = 0; i < MAX_N; i++) MM_ARRAY_FREE(char, strs[i]);
+    MM_ARRAY_FREE(mm_array_ptr<char>, strs);
+    return 0;
+}
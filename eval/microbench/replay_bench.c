@@ -0,0 +1,316 @@
+/**
+ * replay_bench.c - Replay of a recorded allocation trace.
+ *
+ * Run a checked benchmark (parson, lzfse, thttpd, ...) with MM_TRACE=<file>
+ * to record its allocations, frees, and reallocations (see
+ * include/mm_trace.h), then run this benchmark on the trace. It repeats the
+ * same operations with the same sizes in the same order, and reports the
+ * time per operation of the allocator calls, the time spent writing to the
+ * new memory (which includes its page faults) separately, the peak RSS that
+ * the replay added to the process, and how the peak RSS compares to the
+ * peak of the live bytes that the trace asked for. A trace of several threads is replayed by one thread, in
+ * the order of the timestamps of the records.
+ *
+ * Link this file against different libsafemm variants, or build it with
+ * -DREPLAY_MALLOC for plain malloc(), to compare backends without
+ * rebuilding the benchmark that the trace came from (see the Makefile).
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "safe_mm_checked.h"
+
+#ifdef REPLAY_MALLOC
+#define BACKEND "malloc"
+typedef char *obj_t;
+#define OBJ_ALLOC(n) ((char *)malloc(n))
+#define OBJ_CALLOC(n) ((char *)calloc(n, 1))
+#define OBJ_REALLOC(p, n) ((char *)realloc(p, n))
+#define OBJ_FREE(p) free(p)
+#else
+#define BACKEND "libsafemm"
+typedef mm_array_ptr<char> obj_t;
+#define OBJ_ALLOC(n) mm_array_alloc<char>(n)
+#define OBJ_CALLOC(n) mm_calloc<char>(n, 1)
+#define OBJ_REALLOC(p, n) mm_array_realloc<char>(p, n)
+#define OBJ_FREE(p) mm_array_free<char>(p)
+#endif
+
+#define PAGE_SIZE 4096
+/* Sample the RSS once every RSS_INTERVAL operations. */
+#define RSS_INTERVAL 4096
+
+enum { OP_ALLOC, OP_CALLOC, OP_REALLOC, OP_FREE };
+
+/* One operation of the replay, on the object with index id. */
+typedef struct {
+    uint32_t op;
+    uint32_t id;
+    uint64_t size;
+} replay_op_t;
+
+static replay_op_t *ops;
+static size_t num_ops;
+static uint32_t num_objs;
+static uint64_t peak_live;
+
+/*
+ * The index of every live object of the trace by its address. Open
+ * addressing with linear probing; a freed entry becomes a tombstone. Every
+ * record adds at most one entry, so a table twice as large as the trace
+ * never fills up.
+ * */
+#define EMPTY 0
+#define TOMBSTONE 1
+
+typedef struct {
+    uint64_t ptr;
+    uint32_t id;
+} live_entry_t;
+
+static live_entry_t *live_table;
+static size_t live_mask;
+
+static size_t live_slot(uint64_t ptr) {
+    return (ptr * 0x9E3779B97F4A7C15ULL >> 20) & live_mask;
+}
+
+static void live_insert(uint64_t ptr, uint32_t id) {
+    size_t i = live_slot(ptr);
+    while (live_table[i].ptr > TOMBSTONE && live_table[i].ptr != ptr) {
+        i = (i + 1) & live_mask;
+    }
+    live_table[i].ptr = ptr;
+    live_table[i].id = id;
+}
+
+/* Remove ptr from the table and return its index, or -1 if it is not in. */
+static int64_t live_remove(uint64_t ptr) {
+    for (size_t i = live_slot(ptr); live_table[i].ptr != EMPTY;
+         i = (i + 1) & live_mask) {
+        if (live_table[i].ptr == ptr) {
+            live_table[i].ptr = TOMBSTONE;
+            return live_table[i].id;
+        }
+    }
+    return -1;
+}
+
+static int by_time(const void *a, const void *b) {
+    uint64_t ta = ((const mm_trace_record_t *)a)->tsc;
+    uint64_t tb = ((const mm_trace_record_t *)b)->tsc;
+    return ta < tb ? -1 : ta > tb;
+}
+
+/*
+ * Read a trace and turn it into replay operations. A free of an object
+ * that the trace did not see allocated (e.g., one allocated before tracing
+ * started) is left out, and so is the old object of such a reallocation.
+ * */
+static void load_trace(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        exit(1);
+    }
+    mm_trace_header_t header;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, MM_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.record_size != sizeof(mm_trace_record_t)) {
+        fprintf(stderr, "%s is not a libsafemm trace\n", path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    size_t num_records = (ftell(f) - sizeof(header)) /
+                         sizeof(mm_trace_record_t);
+    fseek(f, sizeof(header), SEEK_SET);
+    mm_trace_record_t *records = malloc(num_records * sizeof(*records));
+    if (records == NULL ||
+        fread(records, sizeof(*records), num_records, f) != num_records) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+    qsort(records, num_records, sizeof(*records), by_time);
+
+    size_t table_size = 16;
+    while (table_size < 2 * num_records) table_size *= 2;
+    live_table = calloc(table_size, sizeof(live_entry_t));
+    live_mask = table_size - 1;
+    ops = malloc(num_records * sizeof(replay_op_t));
+    // The sizes of the live objects, to follow the live bytes.
+    uint64_t *sizes = malloc(num_records * sizeof(uint64_t));
+    if (live_table == NULL || ops == NULL || sizes == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    uint64_t live = 0, dropped = 0, skipped = 0;
+
+    for (size_t i = 0; i < num_records; i++) {
+        mm_trace_record_t *r = &records[i];
+        replay_op_t *op = &ops[num_ops];
+        int64_t id;
+        switch (r->op) {
+        case MM_TRACE_ALLOC:
+            op->op = r->aux ? OP_CALLOC : OP_ALLOC;
+            op->id = num_objs++;
+            op->size = r->size;
+            sizes[op->id] = r->size;
+            live += r->size;
+            live_insert(r->ptr, op->id);
+            num_ops++;
+            break;
+        case MM_TRACE_REALLOC:
+            id = live_remove(r->aux);
+            if (id < 0) {
+                op->op = OP_ALLOC;
+                id = num_objs++;
+                skipped++;
+            } else {
+                op->op = OP_REALLOC;
+                live -= sizes[id];
+            }
+            op->id = id;
+            op->size = r->size;
+            sizes[id] = r->size;
+            live += r->size;
+            live_insert(r->ptr, id);
+            num_ops++;
+            break;
+        case MM_TRACE_FREE:
+            id = live_remove(r->ptr);
+            if (id < 0) {
+                skipped++;
+                break;
+            }
+            op->op = OP_FREE;
+            op->id = id;
+            op->size = 0;
+            live -= sizes[id];
+            num_ops++;
+            break;
+        case MM_TRACE_DROPPED:
+            dropped += r->size;
+            break;
+        }
+        if (live > peak_live) peak_live = live;
+    }
+    if (dropped > 0 || skipped > 0) {
+        fprintf(stderr, "warning: the trace dropped %lu records, and %lu "
+                "operations on objects it did not see allocated were left "
+                "out\n", dropped, skipped);
+    }
+
+    free(sizes);
+    free(records);
+    free(live_table);
+}
+
+/* The resident set size of the process in bytes. */
+static uint64_t current_rss(void) {
+    unsigned long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%lu %lu", &pages, &resident) != 2) resident = 0;
+        fclose(f);
+    }
+    return resident * PAGE_SIZE;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The time of a call to now(), which every timed interval below includes
+ * once. */
+static double timer_cost(void) {
+    const int n = 1 << 16;
+    double start = now();
+    for (int i = 0; i < n; i++) now();
+    return (now() - start) / n;
+}
+
+/* Write a byte in every page of p between from and n, as a program that
+ * uses its memory would. */
+static void touch(obj_t p, size_t from, size_t n) {
+    for (size_t i = from; i < n; i += PAGE_SIZE) p[i] = 1;
+}
+
+static void replay(void) {
+    obj_t *objs = malloc(num_objs * sizeof(obj_t));
+    uint64_t *sizes = malloc(num_objs * sizeof(uint64_t));
+    if (objs == NULL || sizes == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    memset(objs, 0, num_objs * sizeof(obj_t));
+    memset(sizes, 0, num_objs * sizeof(uint64_t));
+
+    double cost = timer_cost();
+    uint64_t base_rss = current_rss();
+    uint64_t peak_rss = base_rss;
+    // Only the allocator calls go into secs; the writes to the new memory
+    // go into touch_secs.
+    double secs = 0, touch_secs = 0;
+    size_t num_touches = 0;
+    for (size_t i = 0; i < num_ops; i++) {
+        replay_op_t *op = &ops[i];
+        size_t from = 0;
+        double start = now();
+        switch (op->op) {
+        case OP_ALLOC:
+            objs[op->id] = OBJ_ALLOC(op->size);
+            break;
+        case OP_CALLOC:
+            objs[op->id] = OBJ_CALLOC(op->size);
+            break;
+        case OP_REALLOC:
+            objs[op->id] = OBJ_REALLOC(objs[op->id], op->size);
+            from = sizes[op->id];
+            break;
+        case OP_FREE:
+            OBJ_FREE(objs[op->id]);
+            break;
+        }
+        double end = now();
+        secs += end - start - cost;
+        if (op->op != OP_FREE) {
+            touch(objs[op->id], from, op->size);
+            touch_secs += now() - end - cost;
+            num_touches++;
+        }
+        sizes[op->id] = op->size;
+
+        if (i % RSS_INTERVAL == RSS_INTERVAL - 1) {
+            uint64_t rss = current_rss();
+            if (rss > peak_rss) peak_rss = rss;
+        }
+    }
+    uint64_t rss = current_rss();
+    if (rss > peak_rss) peak_rss = rss;
+
+    printf("%-10s %10lu ops %8.3f s %8.2f ns/op\n", BACKEND, num_ops, secs,
+           secs * 1e9 / (num_ops ? num_ops : 1));
+    printf("%-10s %10lu touches %8.3f s %8.2f ns/touch\n", BACKEND,
+           num_touches, touch_secs,
+           touch_secs * 1e9 / (num_touches ? num_touches : 1));
+    printf("%-10s peak live %lu KB, peak RSS +%lu KB, RSS / live %.2f\n",
+           BACKEND, peak_live >> 10, (peak_rss - base_rss) >> 10,
+           peak_live ? (double)(peak_rss - base_rss) / peak_live : 0.0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+    printf("==== %s ====\n", argv[0]);
+    load_trace(argv[1]);
+    replay();
+    return 0;
+}
@@ -0,0 +1,142 @@
+/**
+ * scale_bench.c - Allocation throughput of libsafemm from 1 to N threads.
+ *
+ * Two workloads run with 1, 2, 4, ... up to N threads (the number of online
+ * CPUs, or the first argument):
+ *
+ * - local: every thread keeps LIVE_OBJS objects alive and replaces a random
+ *   one with an object of a random size between 8 and 263 bytes at each
+ *   step, so all frees are frees of the thread's own objects.
+ * - handoff: in each round, every thread allocates BATCH objects and then
+ *   frees the BATCH objects that its neighbor allocated, so all frees are
+ *   frees of another thread's objects.
+ *
+ * Link this file against libsafemm and libsafemm_notcache (see the
+ * Makefile) to see what the per-thread cache of free blocks buys.
+ * */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "safe_mm_checked.h"
+
+#define LIVE_OBJS 1024
+#define LOCAL_OPS (1 << 21)
+#define BATCH 1024
+#define ROUNDS 512
+#define MAX_THREADS 256
+
+typedef struct {
+    int id;
+    int num_threads;
+    uint64_t seed;
+} worker_t;
+
+/* The objects of the handoff workload, BATCH per thread. */
+static mm_array_ptr<mm_array_ptr<char>> handoff;
+static pthread_barrier_t barrier;
+
+/* xorshift64 so that every run sees the same sequence of sizes. */
+static uint64_t next_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *local_worker(void *arg) {
+    worker_t *w = arg;
+    mm_array_ptr<mm_array_ptr<char>> objs =
+        MM_ARRAY_ALLOC(mm_array_ptr<char>, LIVE_OBJS);
+    for (int i = 0; i < LIVE_OBJS; i++) {
+        objs[i] = MM_ARRAY_ALLOC(char, 8 + next_rand(&w->seed) % 256);
+    }
+
+    for (int i = 0; i < LOCAL_OPS; i++) {
+        unsigned idx = next_rand(&w->seed) % LIVE_OBJS;
+        size_t size = 8 + next_rand(&w->seed) % 256;
+        MM_ARRAY_FREE(char, objs[idx]);
+        objs[idx] = MM_ARRAY_ALLOC(char, size);
+        objs[idx][0] = (char)size;
+    }
+
+    for (int i = 0; i < LIVE_OBJS; i++) {
+        MM_ARRAY_FREE(char, objs[i]);
+    }
+    MM_ARRAY_FREE(mm_array_ptr<char>, objs);
+    return NULL;
+}
+
+static void *handoff_worker(void *arg) {
+    worker_t *w = arg;
+    int mine = w->id * BATCH;
+    int next = (w->id + 1) % w->num_threads * BATCH;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BATCH; i++) {
+            size_t size = 8 + next_rand(&w->seed) % 256;
+            handoff[mine + i] = MM_ARRAY_ALLOC(char, size);
+            handoff[mine + i][0] = (char)size;
+        }
+        pthread_barrier_wait(&barrier);
+        for (int i = 0; i < BATCH; i++) {
+            MM_ARRAY_FREE(char, handoff[next + i]);
+        }
+        pthread_barrier_wait(&barrier);
+    }
+    return NULL;
+}
+
+/*
+ * Run a workload on n threads and return its throughput in Mops/s.
+ * */
+static double run(void *(*worker)(void *), int n, unsigned long ops) {
+    pthread_t threads[MAX_THREADS];
+    worker_t workers[MAX_THREADS];
+    pthread_barrier_init(&barrier, NULL, n);
+
+    double start = now();
+    for (int i = 0; i < n; i++) {
+        workers[i].id = i;
+        workers[i].num_threads = n;
+        workers[i].seed = 88172645463325252ULL + i;
+        pthread_create(&threads[i], NULL, worker, &workers[i]);
+    }
+    for (int i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double secs = now() - start;
+
+    pthread_barrier_destroy(&barrier);
+    return ops * n / secs / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = argc > 1 ? atoi(argv[1])
+                               : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+
+    handoff = MM_ARRAY_ALLOC(mm_array_ptr<char>, MAX_THREADS * BATCH);
+
+    printf("==== %s ====\n", argv[0]);
+    printf("%8s %16s %16s\n", "threads", "local Mops/s", "handoff Mops/s");
+    for (int n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads) {
+        double local = run(local_worker, n, 2UL * LOCAL_OPS);
+        double remote = run(handoff_worker, n, 2UL * ROUNDS * BATCH);
+        printf("%8d %16.2f %16.2f\n", n, local, remote);
+        if (n == max_threads) break;
+    }
+
+    MM_ARRAY_FREE(mm_array_ptr<char>, handoff);
+    return 0;
+}
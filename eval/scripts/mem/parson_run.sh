@@ -4,7 +4,9 @@
 # This script runs the baseline and Checked C parson for the purpose of
 # memory consumption measurement.
 #
-# $1 - "baseline" or "checked"
+# $1 - "baseline", "checked", or "locktable" (the checked parson linked with
+#      libsafemm_locktable, whose objects have no header; it needs a compiler
+#      that emits lock table lookups for the checks)
 #
 
 . common.sh
@@ -37,13 +39,22 @@ run() {
     if [[ $1 == "baseline" ]]; then
         parson_dir=$BASELINE_PARSON_DIR
         data_dir="$DATA_DIR/baseline"
+    elif [[ $1 == "locktable" ]]; then
+        parson_dir=$CHECKED_PARSON_DIR
+        data_dir="$DATA_DIR/locktable"
+        safemm="safemm_locktable"
     else
         parson_dir=$CHECKED_PARSON_DIR
         data_dir="$DATA_DIR/checked"
+        safemm="safemm"
     fi
     mkdir -p $data_dir
     rm -rf $data_dir/*
     cd $parson_dir
+    # The checked and the lock table runs share one build directory.
+    if [[ -n $safemm ]]; then
+        make -B eval SAFEMM=$safemm
+    fi
 
     # Run the evaluation binary and collect memory consumption data.
     for data in ${DATA_FILES[@]}; do
@@ -36,6 +36,10 @@ mem_data = {
             "rss" : {}, "rss_max" : {},
             "wss" : {}, "wss_max" : {}
         },
+        "locktable" : {
+            "rss" : {}, "rss_max" : {},
+            "wss" : {}, "wss_max" : {}
+        },
 }
 
 #
@@ -47,7 +51,7 @@ def Int(num):
 #
 # Collect data in the output files from wss.pl, and compute the max RSS.
 #
-# @param setting: "baseline" or "checked"
+# @param setting: "baseline", "checked", or "locktable"
 #
 def collect_data(setting):
     data_file = open(DATA_DIR + setting + "/mem.stat")
@@ -132,6 +136,41 @@ def write_result():
         print("Max = " + str(round((max(rss_norm) - 1) * 100, 2)) + "%")
         print("Geomean = " + str(round((rss_geomean - 1) * 100, 2)) + "%")
 
+#
+# Write the maximum RSS of the checked thttpd with the locks in object headers
+# and with the locks in the lock table (libsafemm_locktable), both normalized
+# to the baseline, to a CSV file.
+#
+def write_locktable_result():
+    with open(DATA_DIR + "locktable.csv", "w") as mem_csv:
+        writer = csv.writer(mem_csv)
+        header = ["data", "baseline_rss (MB)", "checked_rss (x)",\
+                "locktable_rss (x)"]
+        writer.writerow(header)
+
+        checked_norm, locktable_norm = [], []
+        for key in mem_data["locktable"]["rss_max"]:
+            if key not in mem_data["baseline"]["rss_max"] or \
+               key not in mem_data["checked"]["rss_max"]:
+                   continue
+            baseline_rss_max = mem_data["baseline"]["rss_max"][key]
+            checked_norm += [round(mem_data["checked"]["rss_max"][key] /
+                                   baseline_rss_max, 3)]
+            locktable_norm += [round(mem_data["locktable"]["rss_max"][key] /
+                                     baseline_rss_max, 3)]
+            writer.writerow([key, Int(baseline_rss_max), checked_norm[-1],
+                             locktable_norm[-1]])
+
+        data_num = len(checked_norm)
+        checked_geomean = round(np.array(checked_norm).prod() ** (1.0 / data_num), 3)
+        locktable_geomean = round(np.array(locktable_norm).prod() ** (1.0 / data_num), 3)
+        writer.writerow(["geomean", "", checked_geomean, locktable_geomean])
+        mem_csv.close()
+
+        print("RSS overhead on thttpd with object headers and with the lock table:")
+        print("Headers: Geomean = " + str(round((checked_geomean - 1) * 100, 2)) + "%")
+        print("Lock table: Geomean = " + str(round((locktable_geomean - 1) * 100, 2)) + "%")
+
 #
 # Entrance of this script
 #
@@ -139,9 +178,15 @@ def main():
     # Collect all the raw data generated by wss.
     collect_data("baseline")
     collect_data("checked")
+    # The lock table data are there if the "locktable" run was done.
+    has_locktable = os.path.exists(DATA_DIR + "locktable")
+    if has_locktable:
+        collect_data("locktable")
 
     # Write results to a csv file
     write_result()
+    if has_locktable:
+        write_locktable_result()
 
 if __name__ == "__main__":
     main()
@@ -3,7 +3,13 @@
 #
 # This script runs ab to test the performance of the thttpd server.
 #
-# $1 - (optional) "baseline". Without which this script will run the checked thttpd.
+# $1 - (optional) "baseline" or "locktable". Without which this script will run
+#      the checked thttpd. The lock table thttpd is the checked one linked with
+#      libsafemm_locktable; build and install it with
+#
+#      make CCOPT="-O2 -DMM_LOCK_TABLE" LDFLAGS="-L../../../lib" \
+#           LIBS="-lcrypt -lsafemm_locktable" \
+#           prefix=$ROOT_DIR/benchmark-build/thttpd/locktable install
 #
 
 . common.sh
@@ -28,6 +34,10 @@ init() {
         echo "Run the baseline thttpd"
         SERVER_DIR="$BUILD_DIR/baseline"
         DATA_DIR="$DATA_DIR/baseline"
+    elif [[ $1 == "locktable" ]]; then
+        echo "Run the lock table thttpd"
+        SERVER_DIR="$BUILD_DIR/locktable"
+        DATA_DIR="$DATA_DIR/locktable"
     else
         echo "Run the checked thttpd"
         SERVER_DIR="$BUILD_DIR/checked"
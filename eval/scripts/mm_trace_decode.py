@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+
+'''
+This script decodes a trace written by libsafemm with MM_TRACE=<file> (see
+include/mm_trace.h).
+
+Usage: mm_trace_decode.py [text|lifetimes|summary] <trace file>
+
+  text:      one line per operation, in the order they were written.
+  lifetimes: one CSV line per object: when it was allocated and freed, how
+             long it lived, and its size. Objects that are never freed have
+             an empty free time.
+  summary:   counts of the operations and of dropped records, and the
+             distribution of object lifetimes.
+
+Times are in microseconds since the first record. The clock records of the
+trace are used to convert TSC ticks to time; without two of them, times are
+in ticks.
+'''
+
+import struct
+import sys
+
+MAGIC = b"MMTRACE1"
+HEADER = struct.Struct("<8sII")
+RECORD = struct.Struct("<QIIQQQQ")
+
+ALLOC, FREE, REALLOC, CLOCK, DROPPED = 1, 2, 3, 4, 5
+OP_NAMES = {ALLOC: "alloc", FREE: "free", REALLOC: "realloc",
+            CLOCK: "clock", DROPPED: "dropped"}
+
+
+#
+# Read the records of a trace file.
+#
+def read_trace(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, version, record_size = HEADER.unpack_from(data, 0)
+    if magic != MAGIC or record_size != RECORD.size:
+        sys.exit(path + " is not a libsafemm trace")
+    records = []
+    for off in range(HEADER.size, len(data) - RECORD.size + 1, RECORD.size):
+        records.append(RECORD.unpack_from(data, off))
+    return records
+
+
+#
+# Return a function that maps TSC ticks to microseconds since the first
+# record, fitted to the first and last clock records.
+#
+def make_clock(records):
+    clocks = [(r[0], r[5]) for r in records if r[1] == CLOCK]
+    start = min((r[0] for r in records), default=0)
+    if len(clocks) < 2 or clocks[-1][0] == clocks[0][0]:
+        return lambda tsc: tsc - start
+    (t0, ns0), (t1, ns1) = clocks[0], clocks[-1]
+    ns_per_tick = (ns1 - ns0) / (t1 - t0)
+    return lambda tsc: (tsc - start) * ns_per_tick / 1000.0
+
+
+#
+# Print every record.
+#
+def print_text(records, clock):
+    for tsc, op, tid, ptr, key, size, aux in sorted(records):
+        name = OP_NAMES.get(op, str(op))
+        if op == CLOCK:
+            line = "%.3f %s %d ns" % (clock(tsc), name, size)
+        elif op == DROPPED:
+            line = "%.3f tid %d %s %d records" % (clock(tsc), tid, name, size)
+        else:
+            line = "%.3f tid %d %s 0x%x key %d size %d" % \
+                (clock(tsc), tid, name, ptr, key, size)
+            if op == REALLOC:
+                line += " from 0x%x" % aux
+        print(line)
+
+
+#
+# Match allocations with frees. An object is identified by its address and
+# its key; a realloc ends the life of the old object and starts a new one.
+#
+def lifetimes(records):
+    live = {}
+    objects = []
+    for tsc, op, tid, ptr, key, size, aux in sorted(records):
+        if op == ALLOC or op == REALLOC:
+            if op == REALLOC:
+                old = live.pop(aux, None)
+                if old is not None:
+                    objects.append(old + (tsc,))
+            live[ptr] = (ptr, key, size, tid, tsc)
+        elif op == FREE:
+            obj = live.pop(ptr, None)
+            if obj is not None and obj[1] == key:
+                objects.append(obj + (tsc,))
+    for obj in live.values():
+        objects.append(obj + (None,))
+    objects.sort(key=lambda o: o[4])
+    return objects
+
+
+def print_lifetimes(records, clock):
+    print("ptr,key,size,tid,alloc,free,lifetime")
+    for ptr, key, size, tid, alloc, free in lifetimes(records):
+        if free is None:
+            print("0x%x,%d,%d,%d,%.3f,," % (ptr, key, size, tid, clock(alloc)))
+        else:
+            print("0x%x,%d,%d,%d,%.3f,%.3f,%.3f" % \
+                (ptr, key, size, tid, clock(alloc), clock(free),
+                 clock(free) - clock(alloc)))
+
+
+def print_summary(records, clock):
+    counts = {}
+    for r in records:
+        n = r[5] if r[1] == DROPPED else 1
+        counts[r[1]] = counts.get(r[1], 0) + n
+    for op in (ALLOC, FREE, REALLOC, DROPPED):
+        print("%-8s %d" % (OP_NAMES[op], counts.get(op, 0)))
+
+    objects = lifetimes(records)
+    spans = sorted(clock(o[5]) - clock(o[4]) for o in objects
+                   if o[5] is not None)
+    print("live at the end: %d" % sum(1 for o in objects if o[5] is None))
+    if spans:
+        for pct in (50, 90, 99, 100):
+            i = min(len(spans) - 1, len(spans) * pct // 100)
+            print("lifetime p%-3d %.3f" % (pct, spans[i]))
+
+
+#
+# Entrance of the script.
+#
+if __name__ == "__main__":
+    if len(sys.argv) == 2:
+        mode, path = "text", sys.argv[1]
+    elif len(sys.argv) == 3:
+        mode, path = sys.argv[1], sys.argv[2]
+    else:
+        sys.exit(__doc__)
+
+    records = read_trace(path)
+    clock = make_clock(records)
+    if mode == "text":
+        print_text(records, clock)
+    elif mode == "lifetimes":
+        print_lifetimes(records, clock)
+    elif mode == "summary":
+        print_summary(records, clock)
+    else:
+        sys.exit(__doc__)
@@ -6,6 +6,9 @@ of Checked C and CETS, and writes the results to three files
     - checked.csv
     - cets.csv
     - perf.csv (containing both checked and cets data)
+and, if Olden was also run with the header-inline allocation fast path
+("olden_run.sh inline"),
+    - inline.csv (checked with the fast path off and on)
 '''
 
 from evallib import *
@@ -175,10 +178,46 @@ def write_result():
     print_normalized(normalized_cets, "CETS")
     print_summarized_overhead(min_cets, max_cets, geomean_cets, "CETS")
 
+def write_inline_result(iter):
+    ''' Compare the checked Olden with the inline allocation fast path on. '''
+    exec_time_inline, normalized_inline = {}, {}
+    for prog in BENCHMARKS:
+        exec_time_inline[prog] = 0
+        for i in range(1, iter + 1):
+            data = load_output_json(DATA_DIR / "inline" / f"{prog}.{i}.json")
+            exec_time_inline[prog] += float(data['tests'][0]['metrics']['exec_time'])
+        exec_time_inline[prog] /= iter
+        normalized_inline[prog] = exec_time_inline[prog] / exec_time_baseline[prog]
+
+    with open(DATA_DIR / "inline.csv", "w") as inline_csv:
+        writer = csv.writer(inline_csv)
+        header = ["program", "baseline(s)", "checked(s)", "normalized_checked(x)",\
+                  "inline(s)", "normalized_inline(x)"]
+        writer.writerow(header)
+
+        for prog in BENCHMARKS:
+            row = [prog]
+            row += [round(exec_time_baseline[prog], 2)]
+            row += [round(exec_time_checked[prog], 2)]
+            row += [round(normalized_checked[prog], 3)]
+            row += [round(exec_time_inline[prog], 2)]
+            row += [round(normalized_inline[prog], 3)]
+            writer.writerow(row)
+        geomean_checked = compute_geomean([normalized_checked[p] for p in BENCHMARKS])
+        geomean_inline = compute_geomean([normalized_inline[p] for p in BENCHMARKS])
+        writer.writerow(['Geomean', '', '', geomean_checked, '', geomean_inline])
+
+    print("")
+    print_normalized(normalized_inline, "Checked C (inline allocation)")
+    print(f"Geomean = {convert_normalized_to_overhead(geomean_inline)}")
+
 #
 #  Entrance of this script
 #
 if __name__ == "__main__":
-    collect_data(get_iter_number(OLDEN_RUN_SH))
+    iter = get_iter_number(OLDEN_RUN_SH)
+    collect_data(iter)
 
-    write_result()
\ No newline at end of file
+    write_result()
+    if (DATA_DIR / "inline").exists():
+        write_inline_result(iter)
\ No newline at end of file
@@ -4,7 +4,8 @@
 # This script runs the baseline, checked, or CETS Olden benchmark for
 # performance evaluation.
 #
-# $1: "baseline", "checked", or "cets"
+# $1: "baseline", "checked", "inline" (checked with the header-inline
+#     allocation fast path), or "cets"
 #
 
 set -e
@@ -21,7 +22,7 @@ ITER=20
 #
 main() {
     case $1 in
-        "baseline"|"checked"|"cets")
+        "baseline"|"checked"|"inline"|"cets")
             target=$1
             ;;
         *)
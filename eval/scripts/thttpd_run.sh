@@ -5,6 +5,10 @@
 #
 # $1 - (optional) "baseline". Without which this script will run the checked thttpd.
 #
+# With MM_DEFER_FREE=<batch> (and MM_DEFER_FREE_BG=1) in the environment, the
+# checked thttpd releases freed objects in batches, and the results go to
+# a separate "checked_deferred" directory.
+#
 
 . common.sh
 
@@ -31,7 +35,12 @@ init() {
     else
         echo "Run the checked thttpd"
         SERVER_DIR="$BUILD_DIR/checked"
-        DATA_DIR="$DATA_DIR/checked"
+        if [[ -n $MM_DEFER_FREE ]]; then
+            echo "with deferred frees (batch $MM_DEFER_FREE)"
+            DATA_DIR="$DATA_DIR/checked_deferred"
+        else
+            DATA_DIR="$DATA_DIR/checked"
+        fi
     fi
 
     # Create data directories if not exisiting.
@@ -103,9 +112,16 @@ collect_results() {
 
         # Print a newline
         echo >> bandwidth.dt
+
+        # Latency percentiles (ms) in the same layout.
+        for p in 50 90 99; do
+            grep "^ *$p%" results.$i | awk '{printf "%s,", $2}' >> latency$p.dt
+            echo >> latency$p.dt
+        done
     done
 
     echo "Finished collecting data. Result file is $DATA_DIR/bandwdith.dt"
+    echo "Latency percentiles are in $DATA_DIR/latency{50,90,99}.dt"
 }
 
 #
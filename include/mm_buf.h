@@ -0,0 +1,41 @@
+#ifndef _MM_BUF_H
+#define _MM_BUF_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include "stdchecked.h"
+
+/*
+ * Growable checked buffers of chars.
+ *
+ * data is a regular mmsafe heap array that grows geometrically with
+ * mm_array_realloc(), so it is resized in place when the allocator can and
+ * gets a new key only when it moves. Once data is not NULL, the len chars
+ * of the buffer are always followed by a NUL, and cap (the size of data)
+ * is at least len + 1.
+ *
+ * The functions that can grow the buffer return 0 on success and -1 if the
+ * allocation failed, in which case the buffer is left as it was. Any pointer
+ * into data is invalidated by the next call that grows or shrinks it.
+ * */
+typedef struct {
+    mm_array_ptr<char> data;
+    size_t len;
+    size_t cap;
+} mm_buf_t;
+
+void mm_buf_init(mm_buf_t *buf);
+void mm_buf_free(mm_buf_t *buf);
+void mm_buf_reset(mm_buf_t *buf);
+int mm_buf_reserve(mm_buf_t *buf, size_t n);
+int mm_buf_shrink(mm_buf_t *buf);
+int mm_buf_append(mm_buf_t *buf, mm_array_ptr<const char> s, size_t n);
+int mm_buf_append_raw(mm_buf_t *buf, const char *s, size_t n);
+int mm_buf_append_str(mm_buf_t *buf, mm_array_ptr<const char> s);
+int mm_buf_putc(mm_buf_t *buf, int c);
+int mm_buf_appendf(mm_buf_t *buf, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+int mm_buf_vappendf(mm_buf_t *buf, const char *fmt, va_list ap);
+mm_array_ptr<char> mm_buf_detach(mm_buf_t *buf, size_t *len);
+
+#endif
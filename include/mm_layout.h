@@ -0,0 +1,113 @@
+/*
+ * Layout of the metadata of an mmsafe pointer.
+ *
+ * An mmsafe pointer is a raw pointer followed by a 64-bit metadata word that
+ * holds the key of the referent and the offset of the raw pointer from the
+ * start of the referent. How the 64 bits are split between the two is picked
+ * at build time by defining one of the following macros:
+ *
+ *   MM_LAYOUT_KO_32_32 (default): key in the upper 32 bits, offset in the
+ *                                 lower 32 bits.
+ *   MM_LAYOUT_KO_40_24:           key in the upper 40 bits, offset in the
+ *                                 lower 24 bits.
+ *   MM_LAYOUT_OK_32_32:           offset in the upper 32 bits, key in the
+ *                                 lower 32 bits.
+ *   MM_LAYOUT_OK_24_40:           offset in the upper 24 bits, key in the
+ *                                 lower 40 bits.
+ *
+ * The runtime library, the program, and the checks generated by the compiler
+ * must all use the same layout.
+ *
+ * With a 24-bit offset, an mmsafe pointer can only point into the first
+ * 16 MB of an object. With a 40-bit key, a program can allocate 2^40 objects
+ * before keys wrap around.
+ *
+ * Where the lock of an object is depends on MM_LOCK_TABLE. By default the
+ * lock is inline, in the 16-byte header right before the object, and the
+ * check of a pointer reads it at p - offset - 8. With MM_LOCK_TABLE defined
+ * (libsafemm_locktable), objects have no header; the offset field holds the
+ * slot of the lock in mm_lock_table instead, and pointer arithmetic leaves
+ * it alone. MM_LOCK_ADDR() gives the address of the lock in either mode.
+ * */
+
+#ifndef _MM_LAYOUT_H
+#define _MM_LAYOUT_H
+
+#include <stdint.h>
+
+#if defined(MM_LAYOUT_KO_40_24)
+#define MM_KEY_BITS 40
+#define MM_KEY_SHIFT 24
+#define MM_OFFSET_SHIFT 0
+#elif defined(MM_LAYOUT_OK_32_32)
+#define MM_KEY_BITS 32
+#define MM_KEY_SHIFT 0
+#define MM_OFFSET_SHIFT 32
+#elif defined(MM_LAYOUT_OK_24_40)
+#define MM_KEY_BITS 40
+#define MM_KEY_SHIFT 0
+#define MM_OFFSET_SHIFT 40
+#else
+#ifndef MM_LAYOUT_KO_32_32
+#define MM_LAYOUT_KO_32_32
+#endif
+#define MM_KEY_BITS 32
+#define MM_KEY_SHIFT 32
+#define MM_OFFSET_SHIFT 0
+#endif
+
+#define MM_OFFSET_BITS (64 - MM_KEY_BITS)
+#define MM_KEY_MASK ((1ULL << MM_KEY_BITS) - 1)
+#define MM_OFFSET_MASK ((1ULL << MM_OFFSET_BITS) - 1)
+
+/* A lock has the same width as a key: 4 bytes for 32-bit keys, else 8. */
+#if MM_KEY_BITS == 32
+typedef uint32_t mm_key_t;
+#else
+typedef uint64_t mm_key_t;
+#endif
+
+#define MM_GET_KEY(key_offset) \
+  ((mm_key_t)(((uint64_t)(key_offset) >> MM_KEY_SHIFT) & MM_KEY_MASK))
+#define MM_GET_OFFSET(key_offset) \
+  (((uint64_t)(key_offset) >> MM_OFFSET_SHIFT) & MM_OFFSET_MASK)
+#define MM_MAKE_KEY_OFFSET(key, offset) \
+  (((uint64_t)(key) << MM_KEY_SHIFT) | ((uint64_t)(offset) << MM_OFFSET_SHIFT))
+/* Move the offset of a metadata word by delta bytes. */
+#ifdef MM_LOCK_TABLE
+#define MM_ADD_OFFSET(key_offset, delta) ((uint64_t)(key_offset))
+#else
+#define MM_ADD_OFFSET(key_offset, delta) \
+  ((uint64_t)(key_offset) + ((uint64_t)(delta) << MM_OFFSET_SHIFT))
+#endif
+
+#ifdef MM_LOCK_TABLE
+extern mm_key_t *mm_lock_table;
+#define MM_GET_SLOT(key_offset) MM_GET_OFFSET(key_offset)
+#define MM_LOCK_ADDR(p, key_offset) (mm_lock_table + MM_GET_SLOT(key_offset))
+#else
+#define MM_LOCK_ADDR(p, key_offset) \
+  ((mm_key_t *)((char *)(p) - MM_GET_OFFSET(key_offset) - 8))
+#endif
+
+/*
+ * Every heap object starts with a 16-byte header: an info word followed by
+ * the lock (with MM_LOCK_TABLE, both are kept in the lock table instead).
+ * The info word holds the requested size of the object (without the header)
+ * in its upper 56 bits, and flags of the allocator that owns the block in
+ * its lower 8 bits.
+ * */
+#define MM_INFO_SIZE_SHIFT 8
+#define MM_INFO_FLAGS_MASK 0xffULL
+#define MM_MAKE_INFO(size, flags) \
+  (((uint64_t)(size) << MM_INFO_SIZE_SHIFT) | (uint64_t)(flags))
+#define MM_INFO_SIZE(info) ((uint64_t)(info) >> MM_INFO_SIZE_SHIFT)
+#define MM_INFO_FLAGS(info) ((uint64_t)(info) & MM_INFO_FLAGS_MASK)
+
+// A helper struct that has the same inner structure as an mmsafe ptr.
+typedef struct {
+  void *p;
+  uint64_t key_offset;
+} _MMSafe_ptr_Rep;
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef _SAFE_MM_LIBC_H
 #define _SAFE_MM_LIBC_H
 
+#include <stdarg.h>
 #include "safe_mm_checked.h"
 
 /* string utilities */
@@ -39,10 +40,84 @@ mm_array_ptr<char> mm_memrchr(mm_array_ptr<const char> s, int c, size_t n);
 
 void mm_qsort(mm_array_ptr<mm_ptr<void>> base, size_t nmemb, size_t size,
     int (*compar)(const void *, const void *));
+mm_array_ptr<mm_ptr<void>> mm_bsearch(const void *key,
+    mm_array_ptr<mm_ptr<void>> base, size_t nmemb, size_t size,
+    int (*compar)(const void *, const void *));
+
+/* printf into checked arrays */
+int mm_snprintf(mm_array_ptr<char> dst, size_t size, const char *fmt, ...)
+    __attribute__ ((format (printf, 3, 4)));
+int mm_vsnprintf(mm_array_ptr<char> dst, size_t size, const char *fmt,
+                 va_list ap);
+int mm_asprintf(mm_array_ptr<char> *strp, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+int mm_vasprintf(mm_array_ptr<char> *strp, const char *fmt, va_list ap);
 
 mm_array_ptr<char> mm_strpbrk(mm_array_ptr<const char> p, const char *accept);
 mm_array_ptr<char> mm_strstr(mm_array_ptr<const char> p, const char *needle);
 unsigned long int mm_strtoul(mm_array_ptr<const char> nptr, mm_array_ptr<char> *endptr, int base);
 long int mm_strtol(mm_array_ptr<const char> nptr, mm_array_ptr<char> *endptr, int base);
 double mm_strtod(mm_array_ptr<const char> nptr, mm_array_ptr<char> *endptr);
+
+/*
+ * A checked string view: a checked pointer to the first char of a string and
+ * its length. The chars of a view do not have to be followed by a NUL, so
+ * none of the mm_sv functions below look for one; they use the length
+ * instead of scanning the string again.
+ * */
+typedef struct {
+    mm_array_ptr<const char> p;
+    size_t len;
+} mm_strview;
+
+/* Returned by the find functions when there is no match. */
+#define MM_SV_NPOS ((size_t)-1)
+
+mm_strview mm_sv(mm_array_ptr<const char> s);
+mm_strview mm_sv_n(mm_array_ptr<const char> s, size_t len);
+mm_strview mm_sv_sub(mm_strview sv, size_t pos, size_t len);
+size_t mm_sv_find(mm_strview sv, mm_strview needle);
+size_t mm_sv_find_char(mm_strview sv, int c);
+size_t mm_sv_rfind_char(mm_strview sv, int c);
+int mm_sv_cmp(mm_strview a, mm_strview b);
+int mm_sv_casecmp(mm_strview a, mm_strview b);
+int mm_sv_eq(mm_strview a, mm_strview b);
+int mm_sv_caseeq(mm_strview a, mm_strview b);
+int mm_sv_starts_with(mm_strview sv, mm_strview prefix);
+int mm_sv_ends_with(mm_strview sv, mm_strview suffix);
+int mm_sv_tok(mm_strview *rest, const char *delim, mm_strview *tok);
+size_t mm_sv_to_long(mm_strview sv, int base, long *val);
+size_t mm_sv_to_ulong(mm_strview sv, int base, unsigned long *val);
+size_t mm_sv_to_double(mm_strview sv, double *val);
+
+/*
+ * A reentrant tokenizer over a checked buffer. All of its state is in the
+ * struct, and it neither writes to nor copies the input: every token is
+ * returned as a checked pointer into the buffer plus a length.
+ *
+ *   mm_tokenizer_t tok;
+ *   size_t len;
+ *   mm_tok_init(&tok, line, mm_strlen(line), " \t");
+ *   for (mm_array_ptr<char> word = mm_tok_next(&tok, &len); word != NULL;
+ *        word = mm_tok_next(&tok, &len)) { ... }
+ * */
+#define MM_BYTESET_SIMD_MAX 8
+
+typedef struct {
+    uint64_t bits[4];
+    /* The members of the set if there are at most MM_BYTESET_SIMD_MAX, for
+     * the vectorized scans; nchars is 0 otherwise. */
+    unsigned char chars[MM_BYTESET_SIMD_MAX];
+    unsigned nchars;
+} mm_byteset_t;
+
+typedef struct {
+    mm_array_ptr<char> cur;
+    size_t len;
+    mm_byteset_t delim;
+} mm_tokenizer_t;
+
+void mm_tok_init(mm_tokenizer_t *tok, mm_array_ptr<char> s, size_t len,
+                 const char *delim);
+mm_array_ptr<char> mm_tok_next(mm_tokenizer_t *tok, size_t *len);
 #endif
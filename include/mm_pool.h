@@ -0,0 +1,41 @@
+#ifndef _MM_POOL_H
+#define _MM_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stdchecked.h"
+
+/*
+ * Recycling pools of same-sized mmsafe objects.
+ *
+ * A pool keeps the objects put back into it on a free list and hands them
+ * out again on the next get, like the hand-rolled free lists of many
+ * programs. Unlike such a free list, a put invalidates the lock of the
+ * object and a get writes a fresh key into it, so stale pointers to a
+ * recycled object fail their checks.
+ *
+ * Pool objects are ordinary heap objects: an object from a pool can also be
+ * released by mm_free(), in which case it simply leaves the pool. A pool is
+ * not thread-safe.
+ * */
+typedef struct mm_pool mm_pool_t;
+
+/* How often a get was served from the free list (hit) or the heap (miss). */
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t puts;
+} mm_pool_stats_t;
+
+mm_pool_t *mm_pool_create(size_t size);
+/* Release the pool and the free objects in it. */
+void mm_pool_destroy(mm_pool_t *pool);
+for_any(T) mm_ptr<T> mm_pool_get(mm_pool_t *pool);
+for_any(T) void mm_pool_put(mm_pool_t *pool, mm_ptr<const T> const p);
+void mm_pool_get_stats(mm_pool_t *pool, mm_pool_stats_t *stats);
+
+#define MM_POOL_CREATE(T) mm_pool_create(sizeof(T))
+#define MM_POOL_GET(T, pool) mm_pool_get<T>(pool)
+#define MM_POOL_PUT(T, pool, p) mm_pool_put<T>(pool, p)
+
+#endif
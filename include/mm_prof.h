@@ -0,0 +1,22 @@
+#ifndef _MM_PROF_H
+#define _MM_PROF_H
+
+#include <stdio.h>
+
+/*
+ * Sampling profiler of allocation sites.
+ *
+ * With the MM_PROF environment variable set to a file name, libsafemm
+ * records the call stack of an allocation about once every MM_PROF_RATE
+ * bytes (512 KB by default) allocated through mm_alloc(), mm_array_alloc(),
+ * mm_calloc(), and mm_single_calloc(), and adds up the samples by stack.
+ * At exit, the stacks are written to the file in the folded format of
+ * flame graph tools ("main;f;mm_alloc 1048576"), each with the number of
+ * bytes it is estimated to have allocated.
+ *
+ * mm_prof_write() writes the same output at any time. Without MM_PROF,
+ * nothing is sampled and it writes nothing.
+ * */
+void mm_prof_write(FILE *out);
+
+#endif
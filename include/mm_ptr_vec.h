@@ -0,0 +1,63 @@
+#ifndef _MM_PTR_VEC_H
+#define _MM_PTR_VEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stdchecked.h"
+
+/*
+ * Growable arrays of mmsafe pointers for sharing with unchecked code.
+ *
+ * An array of mm_array_ptr interleaves the raw pointers with their key and
+ * offset words, so every time unchecked code wants the array (e.g., argv
+ * and envp for execve()), _marshal_shared_array_ptr() has to copy the raw
+ * pointers out. A vector keeps the two halves in parallel arrays instead:
+ * raw holds the raw pointers, always followed by a NULL, and meta holds
+ * their key and offset words. raw can be handed to unchecked code as it
+ * is, with no copy, while meta stays around for the checks.
+ *
+ * Elements must not be NULL: a NULL in raw would end the array early for
+ * unchecked code, so mm_ptr_vec_push() and mm_ptr_vec_set() abort on one.
+ *
+ * mm_ptr_vec_get() puts the two halves of an element back together into
+ * an mmsafe pointer, so an access through it is checked as usual;
+ * mm_ptr_vec_checked() checks the key of an element once and gives its raw
+ * pointer. Both abort on an index out of bounds. mm_ptr_vec_raw() gives
+ * raw as it is; mm_ptr_vec_check() checks every element once, e.g., right
+ * before raw goes to unchecked code.
+ *
+ * The functions that can grow the vector return 0 on success and -1 if
+ * the allocation failed, in which case the vector is left as it was. raw
+ * and meta are moved by the next call that grows the vector. A vector is
+ * not thread-safe.
+ * */
+typedef struct {
+    void **raw;
+    uint64_t *meta;
+    size_t len;
+    size_t cap;
+} mm_ptr_vec_t;
+
+void mm_ptr_vec_init(mm_ptr_vec_t *vec);
+void mm_ptr_vec_free(mm_ptr_vec_t *vec);
+void mm_ptr_vec_reset(mm_ptr_vec_t *vec);
+int mm_ptr_vec_reserve(mm_ptr_vec_t *vec, size_t n);
+for_any(T) int mm_ptr_vec_push(mm_ptr_vec_t *vec, mm_array_ptr<T> p);
+for_any(T) mm_array_ptr<T> mm_ptr_vec_get(const mm_ptr_vec_t *vec, size_t i);
+for_any(T) void mm_ptr_vec_set(mm_ptr_vec_t *vec, size_t i, mm_array_ptr<T> p);
+void *mm_ptr_vec_checked(const mm_ptr_vec_t *vec, size_t i);
+void **mm_ptr_vec_raw(const mm_ptr_vec_t *vec);
+void mm_ptr_vec_check(const mm_ptr_vec_t *vec);
+
+/*
+ * Iterate over the elements of a vector: p is each element in turn, as an
+ * mm_array_ptr<T>, and i its index. E.g.,
+ *
+ *     mm_array_ptr<char> arg = NULL;
+ *     MM_PTR_VEC_FOREACH(char, &args, i, arg) { ... }
+ * */
+#define MM_PTR_VEC_FOREACH(T, vec, i, p) \
+  for (size_t i = 0; \
+       i < (vec)->len && ((p) = mm_ptr_vec_get<T>((vec), i), 1); i++)
+
+#endif
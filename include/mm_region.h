@@ -0,0 +1,33 @@
+#ifndef _MM_REGION_H
+#define _MM_REGION_H
+
+#include <stddef.h>
+#include "stdchecked.h"
+
+/*
+ * Regions (arenas) of mmsafe objects.
+ *
+ * A region hands out objects from big chunks with a bump pointer. All the
+ * objects in a chunk share the lock of the chunk: an object has no header
+ * of its own, and a pointer to it is a pointer into the chunk with the key
+ * of the chunk and a non-zero offset. Objects cannot be freed one by one;
+ * mm_free() on one of them fails its offset check. mm_region_destroy()
+ * invalidates every pointer into the region with one lock write per chunk
+ * and releases all the chunks at once.
+ *
+ * Objects are 16-byte aligned and not initialized. A region is not
+ * thread-safe.
+ * */
+typedef struct mm_region mm_region_t;
+
+/* Create a region. A chunk_size of 0 picks MM_REGION_CHUNK_SIZE. */
+mm_region_t *mm_region_create(size_t chunk_size);
+void mm_region_destroy(mm_region_t *region);
+for_any(T) mm_ptr<T> mm_region_alloc(mm_region_t *region, size_t size);
+for_any(T) mm_array_ptr<T> mm_region_array_alloc(mm_region_t *region,
+                                                 size_t size);
+
+#define MM_REGION_ALLOC(T, r) mm_region_alloc<T>(r, sizeof(T))
+#define MM_REGION_ARRAY_ALLOC(T, r, n) mm_region_array_alloc<T>(r, sizeof(T) * n)
+
+#endif
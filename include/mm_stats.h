@@ -0,0 +1,44 @@
+#ifndef _MM_STATS_H
+#define _MM_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Allocation statistics of libsafemm_stats (libsafemm built with MM_STATS).
+ *
+ * Every thread counts its own allocations, frees, and reallocations without
+ * synchronization; the counters of a thread are merged into the totals when
+ * it exits. mm_stats_snapshot() adds up the totals and the counters of the
+ * running threads. If the MM_STATS environment variable is set, the
+ * statistics are written as JSON to the file it names when the program
+ * exits.
+ *
+ * Live and peak bytes are tracked across threads in steps of
+ * MM_STATS_FOLD_BYTES per thread, so peak_live_bytes can be off by that
+ * much per thread. In other builds of the library, all the counters are 0.
+ * */
+#define MM_STATS_SIZE_CLASSES 64
+
+typedef struct {
+    uint64_t allocs;             /* Objects allocated. */
+    uint64_t frees;              /* Objects freed. */
+    uint64_t reallocs_in_place;  /* mm_array_realloc() calls that did not
+                                    move the object. */
+    uint64_t reallocs_moved;     /* mm_array_realloc() calls that did. */
+    uint64_t calloc_bytes;       /* Bytes zeroed for mm_calloc() and
+                                    mm_single_calloc(). */
+    uint64_t alloc_bytes;        /* Payload bytes ever allocated. */
+    uint64_t live_bytes;         /* Payload bytes of the live objects. */
+    uint64_t peak_live_bytes;
+    uint64_t meta_bytes;         /* Header and lock table bytes of the live
+                                    objects. */
+    /* Allocations by size: size_hist[i] counts the sizes in [2^i, 2^(i+1)),
+     * and size_hist[0] also counts the objects of size 0. */
+    uint64_t size_hist[MM_STATS_SIZE_CLASSES];
+} mm_stats_t;
+
+void mm_stats_snapshot(mm_stats_t *stats);
+void mm_stats_write_json(FILE *out);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _MM_TRACE_H
+#define _MM_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Binary tracing of allocations, frees, and reallocations.
+ *
+ * While tracing is on, every heap operation of libsafemm appends a
+ * fixed-size record to a ring buffer of its thread, and a background thread
+ * writes the buffers to the trace file. A thread does not wait for the
+ * writer: when its buffer is full, the record is dropped and counted, unless
+ * the MM_TRACE_LOSSLESS environment variable is set to 1. Tracing is
+ * turned on at startup by setting the MM_TRACE environment variable to the
+ * name of the trace file, or at any time with mm_trace_start(); it does not
+ * need a special build of the library. While it is on, the inline fast path
+ * of MM_INLINE_ALLOC goes through the library, so its objects are traced
+ * too. eval/scripts/mm_trace_decode.py
+ * turns a trace into text or allocation timelines.
+ *
+ * A trace file is an mm_trace_header_t followed by mm_trace_record_t. Times
+ * are in TSC ticks; MM_TRACE_CLOCK records, written by the background
+ * thread, pair a TSC value (in tsc) with CLOCK_MONOTONIC nanoseconds (in
+ * size) so that ticks can be converted to time.
+ * */
+#define MM_TRACE_MAGIC "MMTRACE1"
+
+enum {
+    MM_TRACE_ALLOC = 1,    /* ptr, key, size of a new object; aux is 1 if
+                              it was zeroed. */
+    MM_TRACE_FREE = 2,     /* ptr, key, size of a freed object. */
+    MM_TRACE_REALLOC = 3,  /* New ptr, key, size; aux is the old ptr. */
+    MM_TRACE_CLOCK = 4,    /* See above. */
+    MM_TRACE_DROPPED = 5,  /* size records of thread tid were dropped. */
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} mm_trace_header_t;
+
+typedef struct {
+    uint64_t tsc;
+    uint32_t op;
+    uint32_t tid;
+    uint64_t ptr;
+    uint64_t key;
+    uint64_t size;
+    uint64_t aux;
+} mm_trace_record_t;
+
+/* Start tracing into the file at path. Return 0 on success, -1 otherwise. */
+int mm_trace_start(const char *path);
+/* Stop tracing, write out what is buffered, and close the file. */
+void mm_trace_stop(void);
+
+#endif
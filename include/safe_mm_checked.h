@@ -11,7 +11,15 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include "stdchecked.h"
+#include "mm_layout.h"
 #include "mm_libc.h"
+#include "mm_buf.h"
+#include "mm_ptr_vec.h"
+#include "mm_pool.h"
+#include "mm_region.h"
+#include "mm_stats.h"
+#include "mm_prof.h"
+#include "mm_trace.h"
 
 /* Extract the raw pointer from a checked pointer. */
 #define _GETPTR(T, p) ((T *)(p))
@@ -20,19 +28,34 @@
 #define _GETCHARPTR(p) (((char *)(p)))
 
 /* These macros provide convenience for programmers to type a little less. */
+#if defined(MM_INLINE_ALLOC) && !defined(PORTING) && !defined(MM_LOCK_TABLE) \
+    && !defined(MM_STATS)
+/* The inline fast path at the end of this file. */
+#define MM_ALLOC(T) \
+  ({ _MMSafe_ptr_Rep __mm_p = mm_inline_alloc(sizeof(T)); \
+     *(mm_ptr<T> *)&__mm_p; })
+#define MM_ARRAY_ALLOC(T, n) \
+  ({ _MMSafe_ptr_Rep __mm_p = mm_inline_alloc(sizeof(T) * n); \
+     *(mm_array_ptr<T> *)&__mm_p; })
+#define MM_FREE(T, p) \
+  mm_inline_free(({ __typeof__(p) __mm_q = (p); *(_MMSafe_ptr_Rep *)&__mm_q; }))
+#define MM_ARRAY_FREE(T, p) MM_FREE(T, p)
+#else
 #define MM_ALLOC(T) mm_alloc<T>(sizeof(T))
 #define MM_ARRAY_ALLOC(T, n) mm_array_alloc<T>(sizeof(T) * n)
+#define MM_FREE(T, p) mm_free<T>(p)
+#define MM_ARRAY_FREE(T, p) mm_array_free<T>(p)
+#endif
 #define MM_REALLOC(T, p, n) mm_array_realloc<T>(p, n)
 #define MM_CALLOC(s, T) mm_calloc<T>(s, sizeof(T))
 #define MM_SINGLE_CALLOC(T) mm_single_calloc<T>(sizeof(T))
-#define MM_FREE(T, p) mm_free<T>(p)
-#define MM_ARRAY_FREE(T, p) mm_array_free<T>(p)
-#define MM_CHECKED(T, p) mm_checked<T>(p);
-#define MM_ARRAY_CHECKED(T, p) mmarray_checked<T>(p);
+/* Check p once and get its raw pointer for a loop (see mm_checked()). */
+#define MM_CHECKED(T, p) ((T *)mm_checked<T>(p))
+#define MM_ARRAY_CHECKED(T, p) ((T *)mmarray_checked<T>(p))
 
 // For debug
-#define _GETKEY(p) ((uint32_t)((*(((uint64_t *)p) + 1)) >> 32))
-#define _GETLOCK(p) ((*(((uint32_t *)p) - 2)))
+#define _GETKEY(p) MM_GET_KEY(*(((uint64_t *)p) + 1))
+#define _GETLOCK(p) (*(mm_key_t *)((char *)(p) - 8))
 
 for_any(T) mm_ptr<T> mm_alloc(size_t size);
 for_any(T) void mm_free(mm_ptr<const T> const p);
@@ -44,6 +67,44 @@ for_any(T) mm_array_ptr<T> mm_calloc(size_t nmemb, size_t size);
 for_any(T) mm_ptr<T> mm_single_calloc(size_t size);
 for_any(T) void mm_array_free(mm_array_ptr<const T> const p);
 
+/* Counters of mm_array_realloc() calls that resized an existing object. */
+typedef struct {
+  uint64_t in_place;  /* Resized without moving. */
+  uint64_t remapped;  /* Moved by remapping its pages, without a copy. */
+  uint64_t copied;    /* Moved by copying its payload. */
+} mm_realloc_stats_t;
+
+void mm_get_realloc_stats(mm_realloc_stats_t *stats);
+
+/*
+ * Size queries on the heap object that p points into, read from the info
+ * word in front of its lock. mm_array_size() is the size that was requested
+ * when the object was allocated or last resized; mm_usable_size() is the
+ * number of bytes the block actually has room for. Both are 0 for NULL.
+ * */
+for_any(T) size_t mm_array_size(mm_array_ptr<const T> p);
+for_any(T) size_t mm_usable_size(mm_array_ptr<const T> p);
+
+/*
+ * Objects of at least this many bytes get their own page-aligned mapping
+ * that is unmapped as soon as they are freed. Also settable by the
+ * MM_LARGE_THRESHOLD environment variable.
+ * */
+void mm_set_large_threshold(size_t threshold);
+
+/*
+ * Deferred release. With a non-zero batch, mm_free() and mm_array_free()
+ * still zero the lock of an object right away, but its memory is released
+ * later, together with the next batch - 1 objects that the thread frees,
+ * by the thread itself or, if background is non-zero, by a releaser
+ * thread. A batch of 0 turns it off: the current thread releases its batch
+ * right away, and every other thread on its next free. Also settable by the
+ * MM_DEFER_FREE (batch) and MM_DEFER_FREE_BG environment variables.
+ * mm_flush_deferred_frees() releases the batch of the current thread now.
+ * */
+void mm_defer_free(size_t batch, int background);
+void mm_flush_deferred_frees(void);
+
 /* Extract the raw pointer from a checked pointer. */
 /* Deprecated */
 for_any(T) void *_getptr_mm(mm_ptr<const T> const p);
@@ -58,17 +119,36 @@ for_any(T) void _setptr_mm_array(mm_array_ptr<const T> *p, char *new_p);
 /* Create an mmsafe pointer based on an existing checked pointer. */
 for_any(T) mm_array_ptr<T> _create_mm_array_ptr(mm_array_ptr<const T> p, char *new_p);
 
-/* Mark a checked pointer to be valid */
-for_any(T) void mm_checked(mm_ptr<T> p);
-for_any(T) void mmarray_checked(mm_array_ptr<T> p);
+/*
+ * Check once that p points to a live object and return its raw pointer, or
+ * abort if the object has been freed. A loop can then access the object
+ * through the raw pointer without a check per access, as long as nothing
+ * in the loop may free the object. NULL gives NULL.
+ * */
+for_any(T) void *mm_checked(mm_ptr<T> p);
+for_any(T) void *mmarray_checked(mm_array_ptr<T> p);
 
 /* Marshaling an array of mm_array_ptr to an array of raw pointers. */
 for_any(T) void **_marshal_shared_array_ptr(mm_array_ptr<mm_array_ptr<T>> p);
 for_any(T) void **_marshal_mm_ptr(mm_array_ptr<mm_ptr<T>> p, size_t n);
+/* The same, into buf or a per-thread scratch buffer if buf is NULL. */
+for_any(T) void **_marshal_shared_array_ptr_to(mm_array_ptr<mm_array_ptr<T>> p,
+                                               void **buf, size_t cap);
+for_any(T) void **_marshal_mm_ptr_to(mm_array_ptr<mm_ptr<T>> p, size_t n,
+                                     void **buf);
+/* Reorder p to match an array of its raw pointers reordered by unchecked
+ * code. */
+for_any(T) void _unmarshal_mm_ptr(mm_array_ptr<mm_ptr<T>> p, size_t n,
+                                  void **raw);
 
 /* Checked C version of regular common libc functions. */
 /* mmsafe strdup/strndup */
 mm_array_ptr<char> mm_strdup(mm_array_ptr<const char> p);
+mm_array_ptr<char> mm_strndup(mm_array_ptr<const char> p, size_t n);
+/* The same, also returning the length of the copy in *len. */
+mm_array_ptr<char> mm_strdup_len(mm_array_ptr<const char> p, size_t *len);
+mm_array_ptr<char> mm_strndup_len(mm_array_ptr<const char> p, size_t n,
+                                  size_t *len);
 mm_array_ptr<char> mm_strdup_from_raw(const char *p);
 
 /* Others */
@@ -77,4 +157,114 @@ mm_array_ptr<void> mm_memdup(mm_array_ptr<void> src, size_t len);
 /* Duplicate a string on the heap and return an mm_array_ptr<char> to it.*/
 mm_array_ptr<char> mmize_str(char *p);
 
+/*
+ * Header-inline allocation fast path.
+ *
+ * Each thread keeps a cache of free blocks, one LIFO list per 16-byte size
+ * class, for blocks (payload plus the 16-byte header) of up to
+ * MM_INLINE_MAX_BLOCK bytes, which mm_alloc() and the other allocators use
+ * for small objects. With MM_INLINE_ALLOC defined, MM_ALLOC and
+ * MM_ARRAY_ALLOC also pop a block from the cache and write its lock and key
+ * inline; MM_FREE and MM_ARRAY_FREE do the free checks inline and push the
+ * block back. When the size is a compile-time constant, the size class is
+ * folded away. Everything else (an empty cache, an exhausted key block, a
+ * bigger object, a failed check) goes to the out-of-line slow paths in
+ * safe_mm_checked.c, and so does every call while tracing (mm_trace.h) is
+ * on, so that the trace has the objects of the fast path too.
+ *
+ * A block from the cache has MM_INLINE_TAG and its size class in the flags
+ * of its info word (see mm_layout.h), next to the size of the object, so
+ * the regular mm_free() and mm_array_free() can free it too, and any
+ * libsafemm variant works with programs that use the fast path.
+ *
+ * With 32-bit keys, the upper half of the 8-byte lock slot of a cached
+ * block holds the index of the thread that owns it, and a block that
+ * another thread frees goes back to its owner (see safe_mm_checked.c).
+ * */
+#define MM_INLINE_MAX_BLOCK 512
+#define MM_INLINE_CLASSES (MM_INLINE_MAX_BLOCK / 16)
+#define MM_INLINE_TAG 0x4UL
+/* The size class takes bits 3 to 7 of the info word. */
+#define MM_INLINE_CLASS_SHIFT 3
+/* A thread caches at most this many free blocks per size class. */
+#define MM_INLINE_CACHE_LIMIT 256
+
+typedef struct {
+  void *head[MM_INLINE_CLASSES];
+  uint32_t count[MM_INLINE_CLASSES];
+} mm_tcache_t;
+
+#if MM_KEY_BITS == 32
+#define MM_TCACHE_OWNERS 1
+#define MM_BLOCK_OWNER(block) (*(uint32_t *)((char *)(block) + 12))
+#else
+#define MM_TCACHE_OWNERS 0
+#endif
+
+extern __thread mm_tcache_t mm_tcache;
+/* The owner index of the current thread, or 0 if it has none. */
+extern __thread uint32_t mm_tcache_owner;
+/* The unused keys [mm_thread_key, mm_thread_key_end) of the current thread. */
+extern __thread mm_key_t mm_thread_key;
+extern __thread mm_key_t mm_thread_key_end;
+/* Set while tracing is on (see mm_trace.c). */
+extern int mm_trace_on;
+
+_MMSafe_ptr_Rep mm_inline_alloc_slow(size_t size);
+void mm_inline_free_slow(_MMSafe_ptr_Rep p);
+
+__attribute__((always_inline))
+static inline _MMSafe_ptr_Rep mm_inline_alloc(size_t size) {
+  size_t block_size = size + 16;
+  unsigned cls = (block_size + 15) / 16 - 1;
+  if (__builtin_expect(block_size > MM_INLINE_MAX_BLOCK ||
+                       mm_tcache.head[cls] == NULL ||
+                       mm_thread_key == mm_thread_key_end ||
+                       __atomic_load_n(&mm_trace_on, __ATOMIC_RELAXED), 0)) {
+    return mm_inline_alloc_slow(size);
+  }
+
+  char *block = (char *)mm_tcache.head[cls];
+  mm_tcache.head[cls] = *(void **)block;
+  mm_tcache.count[cls]--;
+
+  mm_key_t key = mm_thread_key++;
+  *(uint64_t *)block =
+      MM_MAKE_INFO(size, MM_INLINE_TAG | ((uint64_t)cls << MM_INLINE_CLASS_SHIFT));
+  *(mm_key_t *)(block + 8) = key;
+
+  _MMSafe_ptr_Rep p = { block + 16, MM_MAKE_KEY_OFFSET(key, 0) };
+  return p;
+}
+
+__attribute__((always_inline))
+static inline void mm_inline_free(_MMSafe_ptr_Rep p) {
+  if (p.p == NULL) return;
+
+  char *lock = (char *)p.p - 8;
+  char *block = lock - 8;
+  if (__builtin_expect(MM_GET_OFFSET(p.key_offset) != 0 ||
+                       MM_GET_KEY(p.key_offset) != *(mm_key_t *)lock ||
+                       !(*(uint64_t *)block & MM_INLINE_TAG) ||
+                       __atomic_load_n(&mm_trace_on, __ATOMIC_RELAXED), 0)) {
+    mm_inline_free_slow(p);
+    return;
+  }
+
+  unsigned cls = MM_INFO_FLAGS(*(uint64_t *)block) >> MM_INLINE_CLASS_SHIFT;
+  if (__builtin_expect(mm_tcache.count[cls] >= MM_INLINE_CACHE_LIMIT
+#if MM_TCACHE_OWNERS
+                       || MM_BLOCK_OWNER(block) != mm_tcache_owner
+#endif
+                       , 0)) {
+    mm_inline_free_slow(p);
+    return;
+  }
+
+  *(mm_key_t *)lock = 0;
+  *(void **)block = mm_tcache.head[cls];
+  mm_tcache.head[cls] = block;
+  mm_tcache.count[cls]++;
+}
+
 #endif
@@ -0,0 +1,141 @@
+/** mm_buf.c - Growable checked buffers of chars.
+ *
+ * The capacity at least doubles every time the buffer has to grow, so
+ * appending n chars one at a time takes O(log n) reallocations.
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "safe_mm_checked.h"
+
+#define MM_BUF_MIN_CAP 64
+
+void mm_buf_init(mm_buf_t *buf) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+void mm_buf_free(mm_buf_t *buf) {
+    mm_array_free<char>(buf->data);
+    mm_buf_init(buf);
+}
+
+/* Empty the buffer but keep its memory. */
+void mm_buf_reset(mm_buf_t *buf) {
+    buf->len = 0;
+    if (buf->data != NULL) _GETCHARPTR(buf->data)[0] = '\0';
+}
+
+/* Resize data to exactly cap chars. */
+static int resize(mm_buf_t *buf, size_t cap) {
+    mm_array_ptr<char> data = mm_array_realloc<char>(buf->data, cap);
+    if (data == NULL) return -1;
+
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+/* Make room for n more chars (and the NUL after them). */
+int mm_buf_reserve(mm_buf_t *buf, size_t n) {
+    if (n >= SIZE_MAX - buf->len) return -1;
+    size_t need = buf->len + n + 1;
+    if (need <= buf->cap) return 0;
+
+    size_t cap = buf->cap < MM_BUF_MIN_CAP ? MM_BUF_MIN_CAP : buf->cap;
+    while (cap < need) {
+        cap = cap > SIZE_MAX / 2 ? need : cap * 2;
+    }
+    int was_empty = buf->data == NULL;
+    if (resize(buf, cap) != 0) return -1;
+    if (was_empty) _GETCHARPTR(buf->data)[0] = '\0';
+    return 0;
+}
+
+/* Give the unused capacity back to the allocator. */
+int mm_buf_shrink(mm_buf_t *buf) {
+    if (buf->data == NULL || buf->cap == buf->len + 1) return 0;
+    return resize(buf, buf->len + 1);
+}
+
+int mm_buf_append_raw(mm_buf_t *buf, const char *s, size_t n) {
+    if (mm_buf_reserve(buf, n) != 0) return -1;
+
+    char *end = _GETCHARPTR(buf->data) + buf->len;
+    memcpy(end, s, n);
+    end[n] = '\0';
+    buf->len += n;
+    return 0;
+}
+
+int mm_buf_append(mm_buf_t *buf, mm_array_ptr<const char> s, size_t n) {
+    return mm_buf_append_raw(buf, _GETCHARPTR(s), n);
+}
+
+int mm_buf_append_str(mm_buf_t *buf, mm_array_ptr<const char> s) {
+    return mm_buf_append_raw(buf, _GETCHARPTR(s), strlen(_GETCHARPTR(s)));
+}
+
+int mm_buf_putc(mm_buf_t *buf, int c) {
+    char ch = (char)c;
+    return mm_buf_append_raw(buf, &ch, 1);
+}
+
+/*
+ * Append formatted output. The output is written straight into the free
+ * space of the buffer; only if it does not fit is the buffer grown and the
+ * output formatted a second time.
+ * */
+int mm_buf_vappendf(mm_buf_t *buf, const char *fmt, va_list ap) {
+    va_list ap2;
+    va_copy(ap2, ap);
+
+    if (mm_buf_reserve(buf, 0) != 0) {
+        va_end(ap2);
+        return -1;
+    }
+    size_t room = buf->cap - buf->len;
+    int n = vsnprintf(_GETCHARPTR(buf->data) + buf->len, room, fmt, ap);
+    if (n < 0) {
+        _GETCHARPTR(buf->data)[buf->len] = '\0';
+        va_end(ap2);
+        return -1;
+    }
+    if ((size_t)n >= room) {
+        if (mm_buf_reserve(buf, n) != 0) {
+            _GETCHARPTR(buf->data)[buf->len] = '\0';
+            va_end(ap2);
+            return -1;
+        }
+        vsnprintf(_GETCHARPTR(buf->data) + buf->len, n + 1, fmt, ap2);
+    }
+    va_end(ap2);
+    buf->len += n;
+    return 0;
+}
+
+int mm_buf_appendf(mm_buf_t *buf, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = mm_buf_vappendf(buf, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+/*
+ * Take the NUL-terminated contents out of the buffer, and store their length
+ * in *len (if len is not NULL). The caller frees them with mm_array_free().
+ * The buffer is left empty. Return NULL if the buffer was empty and an empty
+ * string could not be allocated.
+ * */
+mm_array_ptr<char> mm_buf_detach(mm_buf_t *buf, size_t *len) {
+    if (mm_buf_reserve(buf, 0) != 0) return NULL;
+
+    mm_array_ptr<char> data = buf->data;
+    if (len != NULL) *len = buf->len;
+    mm_buf_init(buf);
+    return data;
+}
@@ -0,0 +1,122 @@
+#ifndef MM_COUNTERS_H
+#define MM_COUNTERS_H
+
+#include <stdint.h>
+
+/*
+ * The per-thread counters behind mm_stats.h, and the hooks through which the
+ * allocation paths update them. Without MM_STATS, the hooks compile to
+ * nothing.
+ *
+ * mm_prof_count() is the hook of the allocation profiler (mm_prof.c), and
+ * mm_trace() the one of the tracer (mm_trace.c). They are in every build;
+ * their fast paths are one subtraction from a thread-local count of the
+ * bytes left until the next sample, and one load of a global flag.
+ * */
+extern __thread int64_t mm_prof_countdown;
+void mm_prof_sample(uint64_t size);
+
+static inline void mm_prof_count(uint64_t size) {
+    mm_prof_countdown -= size;
+    if (__builtin_expect(mm_prof_countdown < 0, 0)) mm_prof_sample(size);
+}
+
+extern int mm_trace_on;
+void mm_trace_event(uint32_t op, void *ptr, uint64_t key, uint64_t size,
+                    uint64_t aux);
+
+static inline void mm_trace(uint32_t op, void *ptr, uint64_t key,
+                            uint64_t size, uint64_t aux) {
+    if (__builtin_expect(__atomic_load_n(&mm_trace_on, __ATOMIC_RELAXED), 0)) {
+        mm_trace_event(op, ptr, key, size, aux);
+    }
+}
+
+#ifdef MM_STATS
+
+#include "mm_stats.h"
+
+/* How far the live bytes of a thread may drift before they are added to
+ * the shared count that the peak is taken from. */
+#ifndef MM_STATS_FOLD_BYTES
+#define MM_STATS_FOLD_BYTES (64 * 1024)
+#endif
+
+typedef struct mm_thread_stats {
+    mm_stats_t counts;  /* live_bytes and peak_live_bytes are unused. */
+    int64_t live_delta; /* Live bytes not yet added to the shared count. */
+    int registered;
+    struct mm_thread_stats *prev, *next;
+} mm_thread_stats_t;
+
+extern __thread mm_thread_stats_t mm_thread_stats;
+
+void mm_stats_register_thread(void);
+void mm_stats_fold_live(mm_thread_stats_t *ts);
+
+/*
+ * The owning thread is the only writer of its counters, but snapshots read
+ * them from other threads, so the updates are relaxed atomic stores.
+ * */
+#define STATS_ADD(field, n) \
+    __atomic_store_n(&(field), (field) + (n), __ATOMIC_RELAXED)
+
+static inline mm_thread_stats_t *stats_self(void) {
+    mm_thread_stats_t *ts = &mm_thread_stats;
+    if (__builtin_expect(!ts->registered, 0)) mm_stats_register_thread();
+    return ts;
+}
+
+static inline void stats_live(mm_thread_stats_t *ts, int64_t delta) {
+    STATS_ADD(ts->live_delta, delta);
+    if (ts->live_delta >= MM_STATS_FOLD_BYTES ||
+        ts->live_delta <= -MM_STATS_FOLD_BYTES) {
+        mm_stats_fold_live(ts);
+    }
+}
+
+static inline void mm_count_alloc(uint64_t size, uint64_t meta, int zeroed) {
+    mm_thread_stats_t *ts = stats_self();
+    unsigned cls = size < 2 ? 0 : 63 - __builtin_clzll(size);
+    STATS_ADD(ts->counts.allocs, 1);
+    STATS_ADD(ts->counts.alloc_bytes, size);
+    STATS_ADD(ts->counts.meta_bytes, meta);
+    STATS_ADD(ts->counts.size_hist[cls], 1);
+    if (zeroed) STATS_ADD(ts->counts.calloc_bytes, size);
+    stats_live(ts, size);
+}
+
+static inline void mm_count_free(uint64_t size, uint64_t meta) {
+    mm_thread_stats_t *ts = stats_self();
+    STATS_ADD(ts->counts.frees, 1);
+    STATS_ADD(ts->counts.meta_bytes, -meta);
+    stats_live(ts, -(int64_t)size);
+}
+
+static inline void mm_count_realloc(uint64_t old_size, uint64_t new_size,
+                                    uint64_t old_meta, uint64_t new_meta,
+                                    int moved) {
+    mm_thread_stats_t *ts = stats_self();
+    STATS_ADD(ts->counts.meta_bytes, new_meta - old_meta);
+    if (moved) {
+        STATS_ADD(ts->counts.reallocs_moved, 1);
+    } else {
+        STATS_ADD(ts->counts.reallocs_in_place, 1);
+    }
+    if (new_size > old_size) {
+        STATS_ADD(ts->counts.alloc_bytes, new_size - old_size);
+    }
+    stats_live(ts, (int64_t)new_size - (int64_t)old_size);
+}
+
+#else
+
+static inline void mm_count_alloc(uint64_t size, uint64_t meta, int zeroed) {}
+static inline void mm_count_free(uint64_t size, uint64_t meta) {}
+static inline void mm_count_realloc(uint64_t old_size, uint64_t new_size,
+                                    uint64_t old_meta, uint64_t new_meta,
+                                    int moved) {}
+
+#endif
+
+#endif
@@ -0,0 +1,210 @@
+/** mm_defer.c - Deferred release of the memory of freed objects.
+ *
+ * With deferred release on, mm_free() and mm_array_free() still check the
+ * pointer and zero the lock of the object right away, so a dangling pointer
+ * fails its check just as before, but the memory of the object goes into a
+ * batch of the thread instead of back to the heap. When the batch has
+ * mm_defer_batch objects, they are released all at once: by the thread
+ * itself, or in background mode by a releaser thread, which takes the
+ * full batches of all threads from a queue. If the releaser falls
+ * DEFER_MAX_QUEUED batches behind, threads release their own batches again.
+ * A thread releases what is left in its batch when it exits, or on its next
+ * free after deferred release is turned off. fork() does
+ * not carry the releaser into the child (e.g., thttpd when it becomes a
+ * daemon), so the child starts its own with its first full batch.
+ *
+ * Blocks of the per-thread cache (MM_INLINE_TAG) are not deferred: putting
+ * one back is already as cheap as adding it to a batch.
+ *
+ * Turn it on with MM_DEFER_FREE=<batch size>, plus MM_DEFER_FREE_BG=1 for
+ * the releaser thread, or with mm_defer_free().
+ * */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "safe_mm_checked.h"
+#include "mm_defer.h"
+
+#define DEFER_MAX_BATCH 4096
+#define DEFER_MAX_QUEUED 64
+
+typedef struct batch {
+    struct batch *next;
+    size_t n;
+    void *payload[DEFER_MAX_BATCH];
+    uint64_t info[DEFER_MAX_BATCH];
+} batch_t;
+
+size_t mm_defer_batch;
+__thread int mm_defer_pending;
+
+static int defer_background;
+static __thread batch_t *thread_batch;
+static pthread_key_t exit_key;
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+
+/* Full batches waiting for the releaser, and empty ones to reuse. */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static batch_t *queue;
+static size_t num_queued;
+static batch_t *spares;
+static int releaser_running;
+
+static void release(batch_t *b) {
+    for (size_t i = 0; i < b->n; i++) {
+        mm_payload_free(b->payload[i], b->info[i]);
+    }
+    b->n = 0;
+}
+
+static void *releaser_main(void *arg) {
+    pthread_mutex_lock(&queue_lock);
+    while (1) {
+        while (queue == NULL) pthread_cond_wait(&queue_cond, &queue_lock);
+        batch_t *b = queue;
+        queue = NULL;
+        num_queued = 0;
+        pthread_mutex_unlock(&queue_lock);
+
+        batch_t *last = b;
+        for (batch_t *p = b; p != NULL; p = p->next) {
+            release(p);
+            last = p;
+        }
+
+        pthread_mutex_lock(&queue_lock);
+        last->next = spares;
+        spares = b;
+    }
+    return NULL;
+}
+
+//
+// Function: thread_exit()
+//
+// Release the batch of an exiting thread.
+//
+static void thread_exit(void *arg) {
+    batch_t *b = thread_batch;
+    if (b != NULL) {
+        release(b);
+        free(b);
+        thread_batch = NULL;
+    }
+}
+
+static void child_after_fork(void) {
+    // The releaser is not in the child; flush() starts a new one.
+    pthread_mutex_init(&queue_lock, NULL);
+    pthread_cond_init(&queue_cond, NULL);
+    releaser_running = 0;
+}
+
+static void defer_setup(void) {
+    if (pthread_key_create(&exit_key, thread_exit) != 0) {
+        fprintf(stderr, "Failed to set up deferred frees.\n");
+        abort();
+    }
+    pthread_atfork(NULL, NULL, child_after_fork);
+}
+
+/* Start the releaser if it is not running. Called with queue_lock held. */
+static void start_releaser(void) {
+    if (releaser_running) return;
+
+    pthread_once(&setup_once, defer_setup);
+    pthread_t releaser;
+    if (pthread_create(&releaser, NULL, releaser_main, NULL) == 0) {
+        pthread_detach(releaser);
+        releaser_running = 1;
+    }
+}
+
+static batch_t *new_batch(void) {
+    pthread_mutex_lock(&queue_lock);
+    batch_t *b = spares;
+    if (b != NULL) spares = b->next;
+    pthread_mutex_unlock(&queue_lock);
+
+    if (b == NULL && (b = malloc(sizeof(batch_t))) == NULL) return NULL;
+    b->n = 0;
+    pthread_once(&setup_once, defer_setup);
+    pthread_setspecific(exit_key, b);
+    thread_batch = b;
+    return b;
+}
+
+//
+// Function: flush()
+//
+// Hand the batch of the current thread to the releaser, or release it.
+//
+static void flush(batch_t *b) {
+    if (__atomic_load_n(&defer_background, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&queue_lock);
+        start_releaser();
+        if (releaser_running && num_queued < DEFER_MAX_QUEUED) {
+            b->next = queue;
+            queue = b;
+            num_queued++;
+            pthread_cond_signal(&queue_cond);
+            pthread_mutex_unlock(&queue_lock);
+            thread_batch = NULL;
+            mm_defer_pending = 0;
+            return;
+        }
+        pthread_mutex_unlock(&queue_lock);
+    }
+    release(b);
+    mm_defer_pending = 0;
+}
+
+void mm_defer_payload(void *payload, uint64_t info) {
+    batch_t *b = thread_batch;
+    if (b == NULL && (b = new_batch()) == NULL) {
+        mm_payload_free(payload, info);
+        return;
+    }
+
+    b->payload[b->n] = payload;
+    b->info[b->n] = info;
+    b->n++;
+    mm_defer_pending = 1;
+    if (b->n >= __atomic_load_n(&mm_defer_batch, __ATOMIC_RELAXED) ||
+        b->n == DEFER_MAX_BATCH) {
+        flush(b);
+    }
+}
+
+void mm_flush_deferred_frees(void) {
+    if (thread_batch != NULL) release(thread_batch);
+    mm_defer_pending = 0;
+}
+
+void mm_defer_free(size_t batch, int background) {
+    if (batch > DEFER_MAX_BATCH) batch = DEFER_MAX_BATCH;
+
+    if (batch != 0 && background) {
+        pthread_mutex_lock(&queue_lock);
+        start_releaser();
+        pthread_mutex_unlock(&queue_lock);
+    }
+    __atomic_store_n(&defer_background, background, __ATOMIC_RELAXED);
+    __atomic_store_n(&mm_defer_batch, batch, __ATOMIC_RELAXED);
+    if (batch == 0) mm_flush_deferred_frees();
+}
+
+__attribute__((constructor))
+static void defer_init(void) {
+    const char *batch = getenv("MM_DEFER_FREE");
+    if (batch == NULL) return;
+
+    char *end;
+    unsigned long long val = strtoull(batch, &end, 0);
+    if (end == batch || *end != '\0') return;
+    const char *background = getenv("MM_DEFER_FREE_BG");
+    mm_defer_free(val, background != NULL && atoi(background) != 0);
+}
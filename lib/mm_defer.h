@@ -0,0 +1,23 @@
+#ifndef MM_DEFER_H
+#define MM_DEFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Deferred release of the memory of freed objects (see mm_defer.c).
+ *
+ * mm_defer_batch is the number of objects in a batch, or 0 when objects
+ * are released right away. mm_defer_payload() adds the payload of a freed
+ * object, whose lock has already been zeroed, to the batch of the thread.
+ * mm_defer_pending is set while the batch of the thread holds objects, so
+ * that the thread can release them on its next free after deferred release
+ * is turned off. mm_payload_free() (safe_mm_checked.c) releases one object.
+ * */
+extern size_t mm_defer_batch;
+extern __thread int mm_defer_pending;
+
+void mm_defer_payload(void *payload, uint64_t info);
+void mm_payload_free(void *payload, uint64_t info);
+
+#endif
@@ -0,0 +1,163 @@
+/** mm_large.c - Mapping-backed blocks for large mmsafe objects.
+ *
+ * A large block has its own private anonymous mapping:
+ *
+ *     | guard page | header page        | payload pages ...
+ *                    ... | padding | lock | payload ...
+ *                                         ^ page aligned
+ *
+ * The padding word and the lock take the last 16 bytes of the header page,
+ * so the payload starts on a page boundary. The memory is zeroed by the
+ * kernel, so mm_calloc() gets it for free. Growing a block only remaps its
+ * pages: the payload is never copied, and the RSS does not double while a
+ * multi-hundred-MB buffer grows. Freeing a block unmaps it right away, so
+ * huge short-lived buffers do not inflate the RSS of a long-running process.
+ * As with the chunks that malloc() serves by mmap(), a dangling pointer to a
+ * freed large object faults on its first check instead of failing it.
+ *
+ * The guard page is a separate PROT_NONE mapping because mremap() cannot
+ * resize a range that spans mappings with different protections. It is
+ * placed again after a block moves, if the page before the new address is
+ * free; otherwise the moved block has no guard page.
+ * */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mm_large.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#define HEADER_SIZE 16
+
+size_t mm_large_threshold = MM_LARGE_THRESHOLD;
+
+static size_t page_size;
+
+__attribute__ ((constructor))
+static void mm_large_init(void) {
+    page_size = sysconf(_SC_PAGESIZE);
+
+    char *threshold = getenv("MM_LARGE_THRESHOLD");
+    if (threshold != NULL) {
+        char *end;
+        unsigned long long val = strtoull(threshold, &end, 0);
+        if (end != threshold && *end == '\0') mm_large_threshold = val;
+    }
+}
+
+/* Change the size from which objects get their own mapping. */
+void mm_set_large_threshold(size_t threshold) {
+    mm_large_threshold = threshold;
+}
+
+static inline size_t round_to_pages(size_t size) {
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/* Length of the mapping, without the guard page, for a block of size bytes. */
+static inline size_t mapping_size(size_t size) {
+    return page_size + round_to_pages(size - HEADER_SIZE);
+}
+
+/* Length of the mapping of a large block, from the size in its info word. */
+static inline size_t block_mapping_size(void *block) {
+    return mapping_size(MM_INFO_SIZE(*(uint64_t *)block) + HEADER_SIZE);
+}
+
+/* Try to put a guard page right before addr. */
+static bool map_guard(char *addr) {
+    void *guard = mmap(addr - page_size, page_size, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                       MAP_FIXED_NOREPLACE, -1, 0);
+    if (guard == MAP_FAILED) return false;
+    if (guard != addr - page_size) {
+        // An old kernel took MAP_FIXED_NOREPLACE as a hint.
+        munmap(guard, page_size);
+        return false;
+    }
+    return true;
+}
+
+void *mm_large_alloc(size_t size) {
+    // In case another constructor allocates before mm_large_init() runs.
+    if (page_size == 0) mm_large_init();
+
+    size_t len = mapping_size(size);
+    char *map = mmap(NULL, page_size + len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return NULL;
+
+    // Without a guard, the mapping must start at the header, which is where
+    // mm_large_free() and mm_large_realloc() take it to start then.
+    uint64_t flags = MM_LARGE_TAG;
+    if (mprotect(map, page_size, PROT_NONE) == 0) {
+        flags |= MM_LARGE_GUARD;
+    } else {
+        munmap(map, page_size);
+    }
+
+    void *block = map + 2 * page_size - HEADER_SIZE;
+    *(uint64_t *)block = MM_MAKE_INFO(size - HEADER_SIZE, flags);
+    return block;
+}
+
+//
+// Function: mm_large_realloc()
+//
+// Resize the mapping of a large block. The kernel extends it in place if
+// the address space after it is free, and otherwise moves its pages to a
+// new address. Either way no byte of the payload is copied.
+//
+void *mm_large_realloc(void *block, size_t size) {
+    char *header = block + HEADER_SIZE - page_size;
+    uint64_t flags = *(uint64_t *)block & MM_LARGE_FLAGS;
+    size_t old_len = block_mapping_size(block);
+    size_t len = mapping_size(size);
+    if (len == old_len) {
+        *(uint64_t *)block = MM_MAKE_INFO(size - HEADER_SIZE, flags);
+        return block;
+    }
+
+#ifdef __linux__
+    char *new_header = mremap(header, old_len, len, MREMAP_MAYMOVE);
+    if (new_header == MAP_FAILED) return NULL;
+#else
+    char *new_header = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (new_header == MAP_FAILED) return NULL;
+    memcpy(new_header, header, old_len < len ? old_len : len);
+    munmap(header, old_len);
+#endif
+
+    if (new_header != header) {
+        if (flags & MM_LARGE_GUARD) munmap(header - page_size, page_size);
+        flags = MM_LARGE_TAG;
+        if (map_guard(new_header)) flags |= MM_LARGE_GUARD;
+    }
+
+    void *new_block = new_header + page_size - HEADER_SIZE;
+    *(uint64_t *)new_block = MM_MAKE_INFO(size - HEADER_SIZE, flags);
+    return new_block;
+}
+
+void mm_large_free(void *block) {
+    char *header = block + HEADER_SIZE - page_size;
+    size_t len = block_mapping_size(block);
+
+    if (*(uint64_t *)block & MM_LARGE_GUARD) {
+        munmap(header - page_size, page_size + len);
+    } else {
+        munmap(header, len);
+    }
+}
+
+size_t mm_large_usable_size(void *block) {
+    return block_mapping_size(block) - page_size;
+}
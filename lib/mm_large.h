@@ -0,0 +1,46 @@
+#ifndef MM_LARGE_H
+#define MM_LARGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mm_layout.h"
+
+/*
+ * Large mmsafe objects live in their own anonymous mapping. Their payload
+ * starts on a page boundary, they are resized with mremap() instead of
+ * being copied, and their pages go back to the OS as soon as they are freed.
+ *
+ * Like a heap block, a large block starts with the HEAP_PADDING word and the
+ * lock, which are the last 16 bytes of a header page in front of the payload.
+ * The info word of a large block has MM_LARGE_TAG set; no other kind of
+ * block has that flag, so the two kinds can be told apart when freeing. The
+ * length of the mapping follows from the size in the info word.
+ *
+ * Objects of at least mm_large_threshold bytes (including the 16-byte
+ * header) are large. The default is MM_LARGE_THRESHOLD. It can be changed
+ * by the MM_LARGE_THRESHOLD environment variable or mm_set_large_threshold().
+ * */
+#ifndef MM_LARGE_THRESHOLD
+#define MM_LARGE_THRESHOLD (1UL << 20)
+#endif
+
+#define MM_LARGE_TAG 0x1UL
+/* There is a PROT_NONE guard page right before the header page. */
+#define MM_LARGE_GUARD 0x2UL
+#define MM_LARGE_FLAGS (MM_LARGE_TAG | MM_LARGE_GUARD)
+
+extern size_t mm_large_threshold;
+
+static inline bool mm_is_large_block(void *block) {
+    return (*(uint64_t *)block & MM_LARGE_TAG) != 0;
+}
+
+void *mm_large_alloc(size_t size);
+void *mm_large_realloc(void *block, size_t size);
+void mm_large_free(void *block);
+/* Number of payload bytes that fit in the mapping of a large block. */
+size_t mm_large_usable_size(void *block);
+
+#endif
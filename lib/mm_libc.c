@@ -4,18 +4,16 @@
  * */
 
 #include "safe_mm_checked.h"
-#include <string.h>
-
-#ifdef MM_DEBUG
+#include "mm_object.h"
+#include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
 #endif
 
-// A helper struct that has the same inner structure as an mmsafe ptr.
-typedef struct {
-  void *p;
-  uint64_t key_offset;
-} _MMSafe_ptr_Rep;
-
 /* A helper function  for mm_strchr, mm_strchr, etc.
  * See the comment of  _create_mm_array_ptr() in safe_mm_checked.c for details.
  *
@@ -27,7 +25,8 @@ _create_mm_array_ptr_char(mm_array_ptr<const char> p, char *new_p) {
     _MMSafe_ptr_Rep *base_safeptr_ptr = (_MMSafe_ptr_Rep *)&p;
     _MMSafe_ptr_Rep new_safeptr = {
         new_p,
-        base_safeptr_ptr->key_offset + (new_p - (char *)(base_safeptr_ptr->p))
+        MM_ADD_OFFSET(base_safeptr_ptr->key_offset,
+                      new_p - (char *)(base_safeptr_ptr->p))
   };
 
   return *((mm_array_ptr<char> *)&new_safeptr);
@@ -105,29 +104,153 @@ mm_array_ptr<char> mm_strtok_r(mm_array_ptr<char> str, const char *delim,
   }
 }
 
-/* qsort()
+/* qsort() and bsearch()
+ *
+ * mm_qsort() sorts an array of mm_ptr in place. It is an introsort: a
+ * quicksort with a median-of-three pivot that switches to heapsort when the
+ * recursion gets too deep and to insertion sort on short ranges, so it is
+ * O(n log n) in the worst case and never allocates. Elements are moved as a
+ * whole (raw pointer and metadata together). As with qsort() on an array of
+ * raw pointers, the comparator gets the address of the raw pointer of each
+ * element, so the comparators written for the original program work as is.
+ * size must therefore be the size of a raw pointer.
  *
- * TODO? Should we make this accepts pointer of a generic type?
+ * mm_bsearch() searches a sorted array the same way and returns a pointer to
+ * the matching element, or NULL.
  * */
+typedef int (*mm_compar_t)(const void *, const void *);
+
+#define SORT_INSERTION_THRESHOLD 16
+#define SORT_CMP(a, b) compar(&(a)->p, &(b)->p)
+
+static inline void sort_swap(_MMSafe_ptr_Rep *a, _MMSafe_ptr_Rep *b) {
+  _MMSafe_ptr_Rep tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+static void sort_insertion(_MMSafe_ptr_Rep *a, size_t n, mm_compar_t compar) {
+  for (size_t i = 1; i < n; i++) {
+    _MMSafe_ptr_Rep tmp = a[i];
+    size_t j = i;
+    while (j > 0 && SORT_CMP(&tmp, &a[j - 1]) < 0) {
+      a[j] = a[j - 1];
+      j--;
+    }
+    a[j] = tmp;
+  }
+}
+
+static void sort_sift_down(_MMSafe_ptr_Rep *a, size_t root, size_t n,
+                           mm_compar_t compar) {
+  for (;;) {
+    size_t child = 2 * root + 1;
+    if (child >= n) return;
+    if (child + 1 < n && SORT_CMP(&a[child], &a[child + 1]) < 0) child++;
+    if (SORT_CMP(&a[root], &a[child]) >= 0) return;
+    sort_swap(&a[root], &a[child]);
+    root = child;
+  }
+}
+
+static void sort_heap(_MMSafe_ptr_Rep *a, size_t n, mm_compar_t compar) {
+  for (size_t i = n / 2; i-- > 0; ) {
+    sort_sift_down(a, i, n, compar);
+  }
+  for (size_t end = n - 1; end > 0; end--) {
+    sort_swap(&a[0], &a[end]);
+    sort_sift_down(a, 0, end, compar);
+  }
+}
+
+static void sort_intro(_MMSafe_ptr_Rep *a, size_t n, unsigned depth,
+                       mm_compar_t compar) {
+  while (n > SORT_INSERTION_THRESHOLD) {
+    if (depth-- == 0) {
+      sort_heap(a, n, compar);
+      return;
+    }
+
+    // Order a[0], a[mid], and a[n - 1], and move the median to a[0] as the
+    // pivot.
+    size_t mid = n / 2;
+    if (SORT_CMP(&a[mid], &a[0]) < 0) sort_swap(&a[mid], &a[0]);
+    if (SORT_CMP(&a[n - 1], &a[mid]) < 0) {
+      sort_swap(&a[n - 1], &a[mid]);
+      if (SORT_CMP(&a[mid], &a[0]) < 0) sort_swap(&a[mid], &a[0]);
+    }
+    sort_swap(&a[0], &a[mid]);
+
+    // Hoare partition. Both scans stop at elements equal to the pivot, which
+    // keeps the partitions balanced when there are many equal elements.
+    size_t i = 0, j = n;
+    for (;;) {
+      do i++; while (i < n && SORT_CMP(&a[i], &a[0]) < 0);
+      do j--; while (SORT_CMP(&a[0], &a[j]) < 0);
+      if (i >= j) break;
+      sort_swap(&a[i], &a[j]);
+    }
+    sort_swap(&a[0], &a[j]);
+
+    // Recurse into the smaller side and loop on the larger one, so the stack
+    // depth stays O(log n).
+    if (j < n - j - 1) {
+      sort_intro(a, j, depth, compar);
+      a += j + 1;
+      n -= j + 1;
+    } else {
+      sort_intro(a + j + 1, n - j - 1, depth, compar);
+      n = j;
+    }
+  }
+  sort_insertion(a, n, compar);
+}
+
 void mm_qsort(mm_array_ptr<mm_ptr<void>> base, size_t nmemb, size_t size,
     int (*compar)(const void *, const void *)) {
-    void **raw_base = _marshal_mm_ptr<void>(base, nmemb);
-    qsort(raw_base, nmemb, size, compar);
-
-    // Reorganize the original array of mm_ptr.
-    for (unsigned i = 0; i < nmemb; i++) {
-      void *p_raw = raw_base[i];
-      for (unsigned j = i; j < nmemb; j++) {
-        void *p_mmsafe = (void *)(base[j]);
-        if (p_mmsafe == p_raw) {
-          // Swap the two mm_ptr.
-          mm_ptr<void> tmp = base[i];
-          base[i] = base[j];
-          base[j] = tmp;
-        }
+    if (size != sizeof(void *)) {
+      fprintf(stderr, "mm_qsort(): size is not the size of a raw pointer.\n");
+      abort();
+    }
+    if (nmemb < 2) return;
+
+    _MMSafe_ptr_Rep *elems = *(_MMSafe_ptr_Rep **)&base;
+    unsigned depth = 0;
+    for (size_t n = nmemb; n > 1; n >>= 1) {
+      depth += 2;
+    }
+    sort_intro(elems, nmemb, depth, compar);
+}
+
+mm_array_ptr<mm_ptr<void>> mm_bsearch(const void *key,
+    mm_array_ptr<mm_ptr<void>> base, size_t nmemb, size_t size,
+    int (*compar)(const void *, const void *)) {
+    if (size != sizeof(void *)) {
+      fprintf(stderr, "mm_bsearch(): size is not the size of a raw pointer.\n");
+      abort();
+    }
+
+    _MMSafe_ptr_Rep *base_rep = (_MMSafe_ptr_Rep *)&base;
+    _MMSafe_ptr_Rep *elems = (_MMSafe_ptr_Rep *)base_rep->p;
+    size_t lo = 0, hi = nmemb;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      int r = compar(key, &elems[mid].p);
+      if (r == 0) {
+        _MMSafe_ptr_Rep found = {
+          &elems[mid],
+          MM_ADD_OFFSET(base_rep->key_offset,
+                        (char *)&elems[mid] - (char *)elems)
+        };
+        return *((mm_array_ptr<mm_ptr<void>> *)&found);
+      }
+      if (r < 0) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
       }
     }
-    free(raw_base);
+    return NULL;
 }
 
 /* strtoul() */
@@ -156,3 +279,346 @@ double mm_strtod(mm_array_ptr<const char> nptr, mm_array_ptr<char> *endptr) {
     }
     return result;
 }
+
+/*
+ * String views (mm_strview).
+ *
+ * A view is only created from a string by mm_sv(), which computes its length
+ * once; every other function works on the length. The view does not own the
+ * chars: it is only valid as long as the object it points into is.
+ * */
+
+/* A view of a NUL-terminated string. */
+mm_strview mm_sv(mm_array_ptr<const char> s) {
+  return mm_sv_n(s, s == NULL ? 0 : strlen(_GETCHARPTR(s)));
+}
+
+/* A view of the first len chars at s. */
+mm_strview mm_sv_n(mm_array_ptr<const char> s, size_t len) {
+  mm_strview sv = { s, len };
+  return sv;
+}
+
+/* The view of at most len chars of sv starting at pos. */
+mm_strview mm_sv_sub(mm_strview sv, size_t pos, size_t len) {
+  if (pos > sv.len) pos = sv.len;
+  if (len > sv.len - pos) len = sv.len - pos;
+  return mm_sv_n(sv.p + pos, len);
+}
+
+/* The position of the first occurrence of needle in sv, or MM_SV_NPOS. */
+size_t mm_sv_find(mm_strview sv, mm_strview needle) {
+  if (needle.len == 0) return 0;
+  if (needle.len > sv.len) return MM_SV_NPOS;
+
+  char *s = _GETCHARPTR(sv.p);
+  char *found = memmem(s, sv.len, _GETCHARPTR(needle.p), needle.len);
+  return found == NULL ? MM_SV_NPOS : (size_t)(found - s);
+}
+
+/* The position of the first c in sv, or MM_SV_NPOS. */
+size_t mm_sv_find_char(mm_strview sv, int c) {
+  if (sv.len == 0) return MM_SV_NPOS;
+
+  char *s = _GETCHARPTR(sv.p);
+  char *found = memchr(s, c, sv.len);
+  return found == NULL ? MM_SV_NPOS : (size_t)(found - s);
+}
+
+/* The position of the last c in sv, or MM_SV_NPOS. */
+size_t mm_sv_rfind_char(mm_strview sv, int c) {
+  if (sv.len == 0) return MM_SV_NPOS;
+
+  char *s = _GETCHARPTR(sv.p);
+  char *found = memrchr(s, c, sv.len);
+  return found == NULL ? MM_SV_NPOS : (size_t)(found - s);
+}
+
+/* Compare two views like strcmp(). */
+int mm_sv_cmp(mm_strview a, mm_strview b) {
+  size_t n = a.len < b.len ? a.len : b.len;
+  int r = n == 0 ? 0 : memcmp(_GETCHARPTR(a.p), _GETCHARPTR(b.p), n);
+  if (r != 0) return r;
+  return (a.len > b.len) - (a.len < b.len);
+}
+
+/* Compare two views like strcasecmp(), but over all the chars of the views,
+ * NULs included. */
+int mm_sv_casecmp(mm_strview a, mm_strview b) {
+  size_t n = a.len < b.len ? a.len : b.len;
+  const char *s = n == 0 ? NULL : _GETCHARPTR(a.p);
+  const char *t = n == 0 ? NULL : _GETCHARPTR(b.p);
+  for (size_t i = 0; i < n; i++) {
+    int r = tolower((unsigned char)s[i]) - tolower((unsigned char)t[i]);
+    if (r != 0) return r;
+  }
+  return (a.len > b.len) - (a.len < b.len);
+}
+
+/* Equality tests. Views of different lengths are rejected without reading
+ * any chars. */
+int mm_sv_eq(mm_strview a, mm_strview b) {
+  return a.len == b.len &&
+         (a.len == 0 || memcmp(_GETCHARPTR(a.p), _GETCHARPTR(b.p), a.len) == 0);
+}
+
+int mm_sv_caseeq(mm_strview a, mm_strview b) {
+  return a.len == b.len && mm_sv_casecmp(a, b) == 0;
+}
+
+int mm_sv_starts_with(mm_strview sv, mm_strview prefix) {
+  return prefix.len <= sv.len && mm_sv_eq(mm_sv_n(sv.p, prefix.len), prefix);
+}
+
+int mm_sv_ends_with(mm_strview sv, mm_strview suffix) {
+  return suffix.len <= sv.len &&
+         mm_sv_eq(mm_sv_sub(sv, sv.len - suffix.len, suffix.len), suffix);
+}
+
+/*
+ * Byte sets for the tokenizers.
+ *
+ * byteset_span() and byteset_cspan() are strspn() and strcspn() with a
+ * length instead of a NUL. A set of up to MM_BYTESET_SIMD_MAX chars is
+ * matched 16 chars at a time, by comparing a block against each member of
+ * the set with SSE2 and combining the results; bigger sets use the bitmap.
+ * */
+static void byteset_init(mm_byteset_t *set, const char *chars) {
+  memset(set, 0, sizeof(*set));
+  size_t n = strlen(chars);
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = chars[i];
+    if (set->bits[c >> 6] & (1ULL << (c & 63))) continue;
+    set->bits[c >> 6] |= 1ULL << (c & 63);
+    if (set->nchars < MM_BYTESET_SIMD_MAX) set->chars[set->nchars] = c;
+    set->nchars++;
+  }
+  if (set->nchars > MM_BYTESET_SIMD_MAX) set->nchars = 0;
+}
+
+static inline int byteset_has(const mm_byteset_t *set, unsigned char c) {
+  return (set->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+#ifdef __SSE2__
+/* A 16-bit mask of the chars of the block at s that are in the set. */
+static inline unsigned byteset_match16(const mm_byteset_t *set,
+                                       const char *s) {
+  __m128i block = _mm_loadu_si128((const __m128i *)s);
+  __m128i match = _mm_setzero_si128();
+  for (unsigned i = 0; i < set->nchars; i++) {
+    __m128i c = _mm_set1_epi8((char)set->chars[i]);
+    match = _mm_or_si128(match, _mm_cmpeq_epi8(block, c));
+  }
+  return (unsigned)_mm_movemask_epi8(match);
+}
+#endif
+
+/* The length of the prefix of s that only has chars in the set. */
+static size_t byteset_span(const mm_byteset_t *set, const char *s, size_t n) {
+  size_t i = 0;
+#ifdef __SSE2__
+  if (set->nchars != 0) {
+    for (; i + 16 <= n; i += 16) {
+      unsigned miss = ~byteset_match16(set, s + i) & 0xffff;
+      if (miss != 0) return i + __builtin_ctz(miss);
+    }
+  }
+#endif
+  while (i < n && byteset_has(set, s[i])) i++;
+  return i;
+}
+
+/* The length of the prefix of s that has no chars in the set. */
+static size_t byteset_cspan(const mm_byteset_t *set, const char *s, size_t n) {
+  size_t i = 0;
+#ifdef __SSE2__
+  if (set->nchars != 0) {
+    for (; i + 16 <= n; i += 16) {
+      unsigned hit = byteset_match16(set, s + i);
+      if (hit != 0) return i + __builtin_ctz(hit);
+    }
+  }
+#endif
+  while (i < n && !byteset_has(set, s[i])) i++;
+  return i;
+}
+
+/*
+ * Tokenize a view like strtok_r(), without writing to the string: skip the
+ * delimiters at the start of *rest, store the token that follows in *tok,
+ * and advance *rest past it. Return 0 when there are no more tokens.
+ * */
+int mm_sv_tok(mm_strview *rest, const char *delim, mm_strview *tok) {
+  mm_byteset_t set;
+  byteset_init(&set, delim);
+
+  char *s = _GETCHARPTR(rest->p);
+  size_t skip = byteset_span(&set, s, rest->len);
+  if (skip == rest->len) {
+    *rest = mm_sv_sub(*rest, rest->len, 0);
+    return 0;
+  }
+
+  size_t end = skip + byteset_cspan(&set, s + skip, rest->len - skip);
+  *tok = mm_sv_sub(*rest, skip, end - skip);
+  *rest = mm_sv_sub(*rest, end, rest->len - end);
+  return 1;
+}
+
+/*
+ * mm_tok_init() and mm_tok_next(): tokenize the len chars at s. delim is only
+ * read by mm_tok_init().
+ * */
+void mm_tok_init(mm_tokenizer_t *tok, mm_array_ptr<char> s, size_t len,
+                 const char *delim) {
+  tok->cur = s;
+  tok->len = s == NULL ? 0 : len;
+  byteset_init(&tok->delim, delim);
+}
+
+/* Return the next token and store its length in *len, or return NULL if
+ * there are no more tokens. */
+mm_array_ptr<char> mm_tok_next(mm_tokenizer_t *tok, size_t *len) {
+  if (tok->len == 0) return NULL;
+
+  char *s = _GETCHARPTR(tok->cur);
+  size_t skip = byteset_span(&tok->delim, s, tok->len);
+  if (skip == tok->len) {
+    tok->cur = tok->cur + skip;
+    tok->len = 0;
+    return NULL;
+  }
+
+  size_t n = byteset_cspan(&tok->delim, s + skip, tok->len - skip);
+  mm_array_ptr<char> token = tok->cur + skip;
+  tok->cur = token + n;
+  tok->len -= skip + n;
+  *len = n;
+  return token;
+}
+
+/*
+ * Conversion of a view to a number. The libc functions need a NUL-terminated
+ * string, so the start of the view is copied to a buffer on the stack first.
+ * Return the number of chars that were converted, or 0 if there is no
+ * number at the start of sv or it is too long for the buffer.
+ * */
+#define SV_NUMBER_MAX 128
+
+static size_t sv_number_copy(mm_strview sv, char *buf) {
+  size_t n = sv.len < SV_NUMBER_MAX - 1 ? sv.len : SV_NUMBER_MAX - 1;
+  if (n > 0) memcpy(buf, _GETCHARPTR(sv.p), n);
+  buf[n] = '\0';
+  return n;
+}
+
+static size_t sv_number_end(mm_strview sv, char *buf, size_t n, char *end) {
+  size_t used = end - buf;
+  // The number may go on past what fit in the buffer.
+  if (used == n && n < sv.len) return 0;
+  return used;
+}
+
+size_t mm_sv_to_long(mm_strview sv, int base, long *val) {
+  char buf[SV_NUMBER_MAX], *end;
+  size_t n = sv_number_copy(sv, buf);
+  *val = strtol(buf, &end, base);
+  return sv_number_end(sv, buf, n, end);
+}
+
+size_t mm_sv_to_ulong(mm_strview sv, int base, unsigned long *val) {
+  char buf[SV_NUMBER_MAX], *end;
+  size_t n = sv_number_copy(sv, buf);
+  *val = strtoul(buf, &end, base);
+  return sv_number_end(sv, buf, n, end);
+}
+
+size_t mm_sv_to_double(mm_strview sv, double *val) {
+  char buf[SV_NUMBER_MAX], *end;
+  size_t n = sv_number_copy(sv, buf);
+  *val = strtod(buf, &end);
+  return sv_number_end(sv, buf, n, end);
+}
+
+/*
+ * printf into checked arrays.
+ *
+ * mm_snprintf() and mm_vsnprintf() format straight into the object that dst
+ * points into. The destination is checked once, before formatting: it must
+ * not be NULL or have been freed, and size must not go past the end of the
+ * object.
+ * Pointers to stack and global objects carry no size, so only size bounds
+ * them. mm_asprintf() formats into an mm_buf_t and hands its array over.
+ * */
+/* Keys 1 and 2 are for stack and global objects, which have no header. */
+#define FIRST_HEAP_KEY 3
+
+static void check_dst(mm_array_ptr<char> dst, size_t size, const char *fn) {
+  _MMSafe_ptr_Rep p = *(_MMSafe_ptr_Rep *)&dst;
+  if (p.p == NULL) {
+    fprintf(stderr, "%s(): the destination is NULL.\n", fn);
+    abort();
+  }
+  mm_key_t key = MM_GET_KEY(p.key_offset);
+  if (key < FIRST_HEAP_KEY) return;
+
+  if (*MM_LOCK_ADDR(p.p, p.key_offset) != key) {
+    fprintf(stderr, "%s(): the destination has been freed.\n", fn);
+    abort();
+  }
+  // dst may point past the end of the object; then there is no room left.
+  _MMSafe_ptr_Rep obj = obj_start(p);
+  size_t obj_size = MM_INFO_SIZE(*OBJ_INFO(obj));
+  size_t offset = (char *)p.p - (char *)obj.p;
+  size_t room = offset < obj_size ? obj_size - offset : 0;
+  if (size > room) {
+    fprintf(stderr, "%s(): size %zu is beyond the end of the destination "
+            "(%zu bytes left).\n", fn, size, room);
+    abort();
+  }
+}
+
+int mm_vsnprintf(mm_array_ptr<char> dst, size_t size, const char *fmt,
+                 va_list ap) {
+  if (size == 0) return vsnprintf(NULL, 0, fmt, ap);
+
+  check_dst(dst, size, "mm_vsnprintf");
+  return vsnprintf(_GETCHARPTR(dst), size, fmt, ap);
+}
+
+int mm_snprintf(mm_array_ptr<char> dst, size_t size, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int ret = mm_vsnprintf(dst, size, fmt, ap);
+  va_end(ap);
+  return ret;
+}
+
+/*
+ * Store a new heap array with the formatted string in *strp and return its
+ * length, or return -1 and leave *strp alone if there was an error.
+ * */
+int mm_vasprintf(mm_array_ptr<char> *strp, const char *fmt, va_list ap) {
+  mm_buf_t buf;
+  mm_buf_init(&buf);
+  if (mm_buf_vappendf(&buf, fmt, ap) != 0) {
+    mm_buf_free(&buf);
+    return -1;
+  }
+  // Give back what the geometric growth over-allocated. It is usually a
+  // shrink in place.
+  mm_buf_shrink(&buf);
+
+  size_t len;
+  *strp = mm_buf_detach(&buf, &len);
+  return (int)len;
+}
+
+int mm_asprintf(mm_array_ptr<char> *strp, const char *fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int ret = mm_vasprintf(strp, fmt, ap);
+  va_end(ap);
+  return ret;
+}
@@ -0,0 +1,82 @@
+/** mm_lock_table.c - Disjoint locks for libsafemm_locktable.
+ *
+ * Both tables are reserved in full at startup and only backed by physical
+ * memory as slots get used. Freed slots are kept on a LIFO list that is
+ * linked through the base field of mm_slot_table, so that the slots of a
+ * program that frees as much as it allocates stay in a few hot pages.
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "mm_lock_table.h"
+
+/* A slot index must fit in the offset field of the metadata of a pointer. */
+#if MM_OFFSET_BITS < 64
+#define NUM_SLOTS (MM_LOCK_TABLE_SLOTS < (1ULL << MM_OFFSET_BITS) ? \
+                   MM_LOCK_TABLE_SLOTS : (1ULL << MM_OFFSET_BITS))
+#else
+#define NUM_SLOTS MM_LOCK_TABLE_SLOTS
+#endif
+
+#define FIRST_FREE_SLOT 3
+
+mm_key_t *mm_lock_table;
+mm_slot_t *mm_slot_table;
+
+static uint64_t next_slot = FIRST_FREE_SLOT;
+/* Head of the list of freed slots, 0 if it is empty. */
+static uint64_t free_slots;
+static volatile char slot_lock;
+
+static void *reserve(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Failed to map the lock table.\n");
+        abort();
+    }
+    return p;
+}
+
+/*
+ * Map the tables before main() so that the checks on pointers to stack and
+ * global objects find their locks.
+ * */
+__attribute__ ((constructor))
+static void lock_table_init(void) {
+    if (mm_lock_table != NULL) return;
+
+    mm_slot_table = reserve(NUM_SLOTS * sizeof(mm_slot_t));
+    mm_lock_table = reserve(NUM_SLOTS * sizeof(mm_key_t));
+    mm_lock_table[1] = 1;
+    mm_lock_table[2] = 2;
+}
+
+uint64_t mm_slot_alloc(void) {
+    // In case another constructor allocates before lock_table_init() runs.
+    if (mm_lock_table == NULL) lock_table_init();
+
+    uint64_t slot = 0;
+    while (__atomic_test_and_set(&slot_lock, __ATOMIC_ACQUIRE)) {
+        __builtin_ia32_pause();
+    }
+    if (free_slots != 0) {
+        slot = free_slots;
+        free_slots = (uint64_t)mm_slot_table[slot].base;
+    } else if (next_slot < NUM_SLOTS) {
+        slot = next_slot++;
+    }
+    __atomic_clear(&slot_lock, __ATOMIC_RELEASE);
+    return slot;
+}
+
+void mm_slot_free(uint64_t slot) {
+    while (__atomic_test_and_set(&slot_lock, __ATOMIC_ACQUIRE)) {
+        __builtin_ia32_pause();
+    }
+    mm_slot_table[slot].base = (void *)free_slots;
+    free_slots = slot;
+    __atomic_clear(&slot_lock, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,35 @@
+#ifndef MM_LOCK_TABLE_H
+#define MM_LOCK_TABLE_H
+
+#include <stdint.h>
+
+#include "mm_layout.h"
+
+/*
+ * The lock table of libsafemm_locktable (built with MM_LOCK_TABLE).
+ *
+ * Every heap object owns one slot. mm_lock_table[slot] is the lock of the
+ * object, and mm_slot_table[slot] holds the start of its payload and its
+ * info word (see mm_layout.h). The locks are packed densely so that the
+ * checks touch as few cache lines as possible; the rest of the slot is only
+ * read by the runtime.
+ *
+ * Slots 1 and 2 hold the constant locks of stack and global objects, whose
+ * keys are 1 and 2. Slot 0 is never handed out.
+ * */
+#ifndef MM_LOCK_TABLE_SLOTS
+#define MM_LOCK_TABLE_SLOTS (1ULL << 28)
+#endif
+
+typedef struct {
+    void *base;
+    uint64_t info;
+} mm_slot_t;
+
+extern mm_slot_t *mm_slot_table;
+
+/* Get a free slot for an object. Return 0 if the table is full. */
+uint64_t mm_slot_alloc(void);
+void mm_slot_free(uint64_t slot);
+
+#endif
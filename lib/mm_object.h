@@ -0,0 +1,57 @@
+#ifndef MM_OBJECT_H
+#define MM_OBJECT_H
+
+#include <stdint.h>
+
+#include "mm_layout.h"
+#ifdef MM_LOCK_TABLE
+#include "mm_lock_table.h"
+#endif
+
+/*
+ * Where the lock and the info word of a heap object are, for the files of
+ * libsafemm that work on objects directly.
+ *
+ * The real lock size is 4 bytes for a 32-bit key but we allocate 8 bytes for
+ * it for alignment. A 40-bit key uses all the 8 bytes.
+ *
+ * With MM_LOCK_TABLE, a heap block is only the payload of an object, and
+ * the lock and the info word of the object are in the lock table. A large
+ * block keeps its header page in both modes, so its payload always starts
+ * LARGE_HEADER bytes after the start of the block.
+ * */
+#define LOCK_MEM 8
+#define HEAP_PADDING 8
+#define LARGE_HEADER 16
+#ifdef MM_LOCK_TABLE
+#define EXTRA_HEAP_MEM 0
+#else
+#define EXTRA_HEAP_MEM 16
+#endif
+
+/*
+ * OBJ_INFO() and OBJ_LOCK() take the mmsafe pointer to the start of an
+ * object. IS_OBJ_START() tells whether a pointer is one.
+ * */
+#ifdef MM_LOCK_TABLE
+#define OBJ_INFO(obj) (&mm_slot_table[MM_GET_SLOT((obj).key_offset)].info)
+#define IS_OBJ_START(obj) \
+    (mm_slot_table[MM_GET_SLOT((obj).key_offset)].base == (obj).p)
+#else
+#define OBJ_INFO(obj) ((uint64_t *)((char *)(obj).p - EXTRA_HEAP_MEM))
+#define IS_OBJ_START(obj) (MM_GET_OFFSET((obj).key_offset) == 0)
+#endif
+#define OBJ_LOCK(obj) MM_LOCK_ADDR((obj).p, (obj).key_offset)
+
+/* The mmsafe pointer to the start of the object that p points into. */
+static inline _MMSafe_ptr_Rep obj_start(_MMSafe_ptr_Rep p) {
+#ifdef MM_LOCK_TABLE
+    p.p = mm_slot_table[MM_GET_SLOT(p.key_offset)].base;
+#else
+    p.p = (char *)p.p - MM_GET_OFFSET(p.key_offset);
+    p.key_offset = MM_MAKE_KEY_OFFSET(MM_GET_KEY(p.key_offset), 0);
+#endif
+    return p;
+}
+
+#endif
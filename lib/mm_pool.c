@@ -0,0 +1,145 @@
+/** mm_pool.c - Recycling pools of same-sized mmsafe objects.
+ *
+ * An object on the free list of a pool keeps its header: the info word still
+ * holds the size of the object, and the lock is 0 so that every pointer to
+ * it fails its checks. The first two words of the payload hold the link to
+ * the next free object and the metadata of the object, which with the lock
+ * table tells where its lock is. Objects that are not on the free list are
+ * plain heap objects of the runtime.
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "safe_mm_checked.h"
+#include "porting_helper.h"
+#include "mm_object.h"
+
+/* Defined in safe_mm_checked.c. */
+mm_key_t mm_get_new_key();
+
+/* How a free object is linked into the free list. */
+typedef struct {
+    void *next;
+    uint64_t key_offset;
+} free_obj_t;
+
+struct mm_pool {
+    size_t size;
+    void *free_list;
+    mm_pool_stats_t stats;
+};
+
+/*
+ * Function: mm_pool_create()
+ *
+ * Create a pool of objects of size bytes. The payload of an object is at
+ * least 16 bytes to make room for the free list link.
+ * */
+mm_pool_t *mm_pool_create(size_t size) {
+    mm_pool_t *pool = calloc(1, sizeof(mm_pool_t));
+    if (pool == NULL) return NULL;
+
+    pool->size = size < sizeof(free_obj_t) ? sizeof(free_obj_t) : size;
+    return pool;
+}
+
+void mm_pool_destroy(mm_pool_t *pool) {
+    if (pool == NULL) return;
+
+    while (pool->free_list != NULL) {
+        free_obj_t *obj = pool->free_list;
+        pool->free_list = obj->next;
+
+        // Give the object its key back to free it the normal way.
+        _MMSafe_ptr_Rep safe_ptr = { obj, obj->key_offset };
+        *OBJ_LOCK(safe_ptr) = MM_GET_KEY(safe_ptr.key_offset);
+#ifdef PORTING
+        insert_mmsafe_ptr(obj);
+#endif
+        mm_free<void>(*(mm_ptr<void> *)&safe_ptr);
+    }
+    free(pool);
+}
+
+/*
+ * Function: mm_pool_get()
+ *
+ * Take an object from the free list of a pool and give it a new key, or
+ * allocate a new object if the free list is empty. Like mm_alloc(), the
+ * payload of the object is not initialized.
+ * */
+for_any(T) mm_ptr<T> mm_pool_get(mm_pool_t *pool) {
+    free_obj_t *obj = pool->free_list;
+    if (obj == NULL) {
+        pool->stats.misses++;
+        return mm_alloc<T>(pool->size);
+    }
+
+    pool->free_list = obj->next;
+    pool->stats.hits++;
+
+    mm_key_t key = mm_get_new_key();
+    _MMSafe_ptr_Rep safe_ptr = {
+        .p = obj,
+        .key_offset = MM_MAKE_KEY_OFFSET(key, MM_GET_OFFSET(obj->key_offset))
+    };
+    *OBJ_LOCK(safe_ptr) = key;
+
+#ifdef PORTING
+    insert_mmsafe_ptr(safe_ptr.p);
+#endif
+
+    return *((mm_ptr<T> *)&safe_ptr);
+}
+
+/*
+ * Function: mm_pool_put()
+ *
+ * Invalidate the lock of an object and put it on the free list of a pool.
+ * The object goes through the same checks as in mm_free(), and it must have
+ * the size of the objects of the pool.
+ * */
+for_any(T) void mm_pool_put(mm_pool_t *pool, mm_ptr<const T> const p) {
+    if (p == NULL) return;
+
+    _MMSafe_ptr_Rep safe_ptr = *(_MMSafe_ptr_Rep *)&p;
+    uint64_t key_offset = safe_ptr.key_offset;
+    if (!IS_OBJ_START(safe_ptr)) {
+        fprintf(stderr, "Invalid Put (non-zero offset in an mmptr).\n");
+        abort();
+    }
+
+    mm_key_t *lock = OBJ_LOCK(safe_ptr);
+    if (MM_GET_KEY(key_offset) != *lock) {
+        fprintf(stderr, "Double Put or Invalid Put: ");
+        fprintf(stderr, "key = %llu, lock = %llu\n",
+                (unsigned long long)MM_GET_KEY(key_offset),
+                (unsigned long long)*lock);
+        abort();
+    }
+
+    uint64_t size = MM_INFO_SIZE(*OBJ_INFO(safe_ptr));
+    if (size != pool->size) {
+        fprintf(stderr, "Invalid Put (object of %llu bytes in a pool of "
+                "%llu-byte objects).\n", (unsigned long long)size,
+                (unsigned long long)pool->size);
+        abort();
+    }
+
+    free_obj_t *obj = safe_ptr.p;
+    *lock = 0;
+    obj->next = pool->free_list;
+    obj->key_offset = key_offset;
+    pool->free_list = obj;
+    pool->stats.puts++;
+
+#ifdef PORTING
+    erase_mmsafe_ptr(obj);
+#endif
+}
+
+void mm_pool_get_stats(mm_pool_t *pool, mm_pool_stats_t *stats) {
+    *stats = pool->stats;
+}
@@ -0,0 +1,183 @@
+/** mm_prof.c - Sampling profiler of allocation sites (see include/mm_prof.h).
+ *
+ * Every thread counts down the bytes it allocates. When the count runs out,
+ * mm_prof_sample() takes the call stack with backtrace() and adds the bytes
+ * allocated since the previous sample to the entry of the stack in a hash
+ * table, then draws the next interval uniformly from [rate / 2, 3 * rate / 2)
+ * so that allocation patterns with a period do not always get sampled at
+ * the same site.
+ *
+ * The table is open addressing with a fixed number of entries. A thread
+ * claims a free entry by setting its hash with a compare-and-swap, then
+ * writes the frames and marks the entry ready; all the other updates are
+ * atomic adds, so sampling threads never take a lock. Samples whose stack
+ * does not fit in the table any more are counted as dropped.
+ * */
+
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm_prof.h"
+#include "mm_counters.h"
+
+#ifndef MM_PROF_TABLE_SIZE
+#define MM_PROF_TABLE_SIZE 4096  /* Must be a power of 2. */
+#endif
+#define MM_PROF_DEPTH 32
+#define MM_PROF_DEFAULT_RATE (512 * 1024)
+
+typedef struct {
+    uint64_t hash;  /* 0 while the entry is free. */
+    int ready;      /* Set once depth and frames are written. */
+    int depth;
+    void *frames[MM_PROF_DEPTH];
+    uint64_t samples;
+    uint64_t bytes;
+} stack_entry_t;
+
+__thread int64_t mm_prof_countdown;
+/* The interval that mm_prof_countdown started from. */
+static __thread int64_t interval;
+static __thread uint64_t rng_state;
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static int enabled;
+static int64_t sample_rate;
+static stack_entry_t *table;
+static uint64_t dropped_bytes;
+
+static void write_prof_file(void) {
+    FILE *out = fopen(getenv("MM_PROF"), "w");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open the MM_PROF file %s.\n",
+                getenv("MM_PROF"));
+        return;
+    }
+    mm_prof_write(out);
+    fclose(out);
+}
+
+static void prof_init(void) {
+    const char *path = getenv("MM_PROF");
+    if (path == NULL || path[0] == '\0') return;
+
+    const char *rate = getenv("MM_PROF_RATE");
+    sample_rate = rate == NULL ? 0 : strtoll(rate, NULL, 10);
+    if (sample_rate <= 0) sample_rate = MM_PROF_DEFAULT_RATE;
+
+    table = calloc(MM_PROF_TABLE_SIZE, sizeof(stack_entry_t));
+    if (table == NULL) {
+        fprintf(stderr, "Failed to allocate the allocation profile.\n");
+        return;
+    }
+    __atomic_store_n(&enabled, 1, __ATOMIC_RELEASE);
+    atexit(write_prof_file);
+}
+
+static int64_t next_interval(void) {
+    if (rng_state == 0) rng_state = (uintptr_t)&rng_state | 1;
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return sample_rate / 2 + (int64_t)(rng_state % (uint64_t)sample_rate);
+}
+
+static void record(void **frames, int depth, uint64_t bytes) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uintptr_t)frames[i]) * 1099511628211ULL;
+    }
+    if (hash == 0) hash = 1;
+
+    for (size_t i = 0; i < MM_PROF_TABLE_SIZE; i++) {
+        stack_entry_t *e = &table[(hash + i) & (MM_PROF_TABLE_SIZE - 1)];
+        uint64_t entry_hash = __atomic_load_n(&e->hash, __ATOMIC_ACQUIRE);
+        if (entry_hash == 0) {
+            if (__atomic_compare_exchange_n(&e->hash, &entry_hash, hash, 0,
+                                            __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE)) {
+                e->depth = depth;
+                memcpy(e->frames, frames, sizeof(void *) * depth);
+                __atomic_store_n(&e->ready, 1, __ATOMIC_RELEASE);
+                entry_hash = hash;
+            }
+        }
+        if (entry_hash != hash) continue;
+
+        // Another thread may still be writing the frames of the entry.
+        while (!__atomic_load_n(&e->ready, __ATOMIC_ACQUIRE)) {
+        }
+        if (e->depth == depth &&
+            memcmp(e->frames, frames, sizeof(void *) * depth) == 0) {
+            __atomic_fetch_add(&e->samples, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&e->bytes, bytes, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    __atomic_fetch_add(&dropped_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+__attribute__((noinline))
+void mm_prof_sample(uint64_t size) {
+    pthread_once(&init_once, prof_init);
+    if (!__atomic_load_n(&enabled, __ATOMIC_ACQUIRE)) {
+        // Never come back to the slow path in this thread.
+        mm_prof_countdown = INT64_MAX;
+        return;
+    }
+
+    // The first call of a thread only starts its countdown.
+    if (interval != 0) {
+        // The sample stands for all the bytes since the previous one.
+        uint64_t bytes = interval - mm_prof_countdown;
+        void *frames[MM_PROF_DEPTH + 1];
+        int depth = backtrace(frames, MM_PROF_DEPTH + 1);
+        // Leave out the frame of this function.
+        if (depth > 1) record(frames + 1, depth - 1, bytes);
+    }
+
+    interval = next_interval();
+    mm_prof_countdown = interval;
+}
+
+/* Write the name of the function of a frame, or its address. */
+static void write_frame(FILE *out, const char *symbol, void *addr) {
+    // backtrace_symbols() gives "file(function+offset) [address]".
+    const char *start = strchr(symbol, '(');
+    if (start != NULL) {
+        size_t len = strcspn(start + 1, "+)");
+        if (len > 0) {
+            fprintf(out, "%.*s", (int)len, start + 1);
+            return;
+        }
+    }
+    fprintf(out, "%p", addr);
+}
+
+void mm_prof_write(FILE *out) {
+    if (!__atomic_load_n(&enabled, __ATOMIC_ACQUIRE)) return;
+
+    for (size_t i = 0; i < MM_PROF_TABLE_SIZE; i++) {
+        stack_entry_t *e = &table[i];
+        if (!__atomic_load_n(&e->ready, __ATOMIC_ACQUIRE)) continue;
+
+        char **symbols = backtrace_symbols(e->frames, e->depth);
+        // Folded stacks start from the outermost frame.
+        for (int j = e->depth - 1; j >= 0; j--) {
+            write_frame(out, symbols == NULL ? "" : symbols[j], e->frames[j]);
+            fputc(j == 0 ? ' ' : ';', out);
+        }
+        fprintf(out, "%llu\n", (unsigned long long)
+                __atomic_load_n(&e->bytes, __ATOMIC_RELAXED));
+        free(symbols);
+    }
+
+    uint64_t dropped = __atomic_load_n(&dropped_bytes, __ATOMIC_RELAXED);
+    if (dropped != 0) {
+        fprintf(out, "[dropped] %llu\n", (unsigned long long)dropped);
+    }
+}
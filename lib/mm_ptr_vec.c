@@ -0,0 +1,126 @@
+/** mm_ptr_vec.c - Growable arrays of mmsafe pointers, stored as two arrays.
+ *
+ * raw and meta are plain malloc() arrays of the same capacity. raw has one
+ * slot more than the number of elements for the terminating NULL; the slot
+ * of meta next to it is unused. The capacity at least doubles every time
+ * the vector has to grow.
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "safe_mm_checked.h"
+
+#define MM_PTR_VEC_MIN_CAP 16
+
+/* What mm_ptr_vec_raw() gives for a vector that has no memory yet. */
+static void *empty_raw[1];
+
+void mm_ptr_vec_init(mm_ptr_vec_t *vec) {
+    vec->raw = NULL;
+    vec->meta = NULL;
+    vec->len = 0;
+    vec->cap = 0;
+}
+
+void mm_ptr_vec_free(mm_ptr_vec_t *vec) {
+    free(vec->raw);
+    free(vec->meta);
+    mm_ptr_vec_init(vec);
+}
+
+/* Empty the vector but keep its memory. */
+void mm_ptr_vec_reset(mm_ptr_vec_t *vec) {
+    vec->len = 0;
+    if (vec->raw != NULL) vec->raw[0] = NULL;
+}
+
+/* Make room for n more elements (and the NULL after them). */
+int mm_ptr_vec_reserve(mm_ptr_vec_t *vec, size_t n) {
+    if (n >= SIZE_MAX / sizeof(void *) - vec->len) return -1;
+    size_t need = vec->len + n + 1;
+    if (need <= vec->cap) return 0;
+
+    // Grow to exactly what is needed if that is more than twice the current
+    // capacity, so that reserving for a known number of elements up front
+    // wastes nothing.
+    size_t cap = vec->cap > SIZE_MAX / sizeof(void *) / 2 ? need
+                                                          : vec->cap * 2;
+    if (cap < need) cap = need;
+    if (cap < MM_PTR_VEC_MIN_CAP) cap = MM_PTR_VEC_MIN_CAP;
+    // A failed second realloc() leaves the first array bigger than cap,
+    // which is harmless.
+    void **raw = realloc(vec->raw, cap * sizeof(void *));
+    if (raw == NULL) return -1;
+    vec->raw = raw;
+    uint64_t *meta = realloc(vec->meta, cap * sizeof(uint64_t));
+    if (meta == NULL) return -1;
+    vec->meta = meta;
+
+    vec->raw[vec->len] = NULL;
+    vec->cap = cap;
+    return 0;
+}
+
+static void check_index(const mm_ptr_vec_t *vec, size_t i, const char *fn) {
+    if (__builtin_expect(i >= vec->len, 0)) {
+        fprintf(stderr, "%s(): index %zu is out of bounds (%zu elements).\n",
+                fn, i, vec->len);
+        abort();
+    }
+}
+
+/* A NULL element would end raw early for unchecked code. */
+static void check_not_null(_MMSafe_ptr_Rep rep, const char *fn) {
+    if (__builtin_expect(rep.p == NULL, 0)) {
+        fprintf(stderr, "%s(): the element is NULL.\n", fn);
+        abort();
+    }
+}
+
+for_any(T) int mm_ptr_vec_push(mm_ptr_vec_t *vec, mm_array_ptr<T> p) {
+    _MMSafe_ptr_Rep rep = *(_MMSafe_ptr_Rep *)&p;
+    check_not_null(rep, "mm_ptr_vec_push");
+    if (mm_ptr_vec_reserve(vec, 1) != 0) return -1;
+
+    vec->raw[vec->len] = rep.p;
+    vec->meta[vec->len] = rep.key_offset;
+    vec->raw[++vec->len] = NULL;
+    return 0;
+}
+
+for_any(T) mm_array_ptr<T> mm_ptr_vec_get(const mm_ptr_vec_t *vec, size_t i) {
+    check_index(vec, i, "mm_ptr_vec_get");
+    _MMSafe_ptr_Rep rep = { vec->raw[i], vec->meta[i] };
+    return *(mm_array_ptr<T> *)&rep;
+}
+
+for_any(T) void mm_ptr_vec_set(mm_ptr_vec_t *vec, size_t i, mm_array_ptr<T> p) {
+    check_index(vec, i, "mm_ptr_vec_set");
+    _MMSafe_ptr_Rep rep = *(_MMSafe_ptr_Rep *)&p;
+    check_not_null(rep, "mm_ptr_vec_set");
+    vec->raw[i] = rep.p;
+    vec->meta[i] = rep.key_offset;
+}
+
+/* Check that element i points to a live object and return its raw pointer. */
+void *mm_ptr_vec_checked(const mm_ptr_vec_t *vec, size_t i) {
+    return mmarray_checked<char>(mm_ptr_vec_get<char>(vec, i));
+}
+
+/*
+ * Return the NULL-terminated array of raw pointers, without a copy. Like
+ * the arrays from _marshal_shared_array_ptr(), it is not checked; it is
+ * good until the vector grows or one of the objects is freed.
+ * */
+void **mm_ptr_vec_raw(const mm_ptr_vec_t *vec) {
+    return vec->raw != NULL ? vec->raw : empty_raw;
+}
+
+/* Check that every element points to a live object. */
+void mm_ptr_vec_check(const mm_ptr_vec_t *vec) {
+    for (size_t i = 0; i < vec->len; i++) {
+        _MMSafe_ptr_Rep rep = { vec->raw[i], vec->meta[i] };
+        mmarray_checked<char>(*(mm_array_ptr<char> *)&rep);
+    }
+}
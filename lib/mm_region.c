@@ -0,0 +1,125 @@
+/** mm_region.c - Regions (arenas) of mmsafe objects.
+ *
+ * A chunk of a region is a regular mmsafe heap array from mm_array_alloc(),
+ * so it has the usual 16-byte header with its own key and lock, and a big
+ * chunk gets its own mapping like any large object. The first 16 bytes of
+ * the payload of a chunk hold the mmsafe pointer to the next chunk; objects
+ * start after it, which also keeps the offset of every object non-zero.
+ *
+ *     | info | lock | next chunk | object | object | ...    | free space |
+ *                   ^ chunk                                 ^ cur        ^ end
+ *
+ * New objects are carved from the most recent chunk. An object that takes
+ * more than a quarter of a chunk gets a chunk of its own, which is linked
+ * behind the most recent one so that the free space of the latter is kept.
+ * */
+
+#include <stdlib.h>
+
+#include "safe_mm_checked.h"
+
+#ifndef MM_REGION_CHUNK_SIZE
+#define MM_REGION_CHUNK_SIZE (64 * 1024)
+#endif
+
+#define CHUNK_LINK sizeof(_MMSafe_ptr_Rep)
+
+struct mm_region {
+    size_t chunk_size;
+    /* The most recent chunk and its free space [cur, end). */
+    _MMSafe_ptr_Rep head;
+    char *cur;
+    char *end;
+};
+
+mm_region_t *mm_region_create(size_t chunk_size) {
+    mm_region_t *region = calloc(1, sizeof(mm_region_t));
+    if (region == NULL) return NULL;
+
+    if (chunk_size == 0) chunk_size = MM_REGION_CHUNK_SIZE;
+    // An object must be reachable with the offset bits of a pointer.
+    if (chunk_size - 1 > MM_OFFSET_MASK) chunk_size = MM_OFFSET_MASK + 1;
+    region->chunk_size = chunk_size;
+    return region;
+}
+
+/*
+ * Function: new_chunk()
+ *
+ * Allocate a chunk and link it behind prev, or make it the new head of the
+ * chunk list if prev is NULL. Return where the pointer to the new chunk is
+ * stored.
+ * */
+static _MMSafe_ptr_Rep *new_chunk(mm_region_t *region, size_t size,
+                                  _MMSafe_ptr_Rep *prev) {
+    mm_array_ptr<char> chunk_ptr = mm_array_alloc<char>(size);
+    _MMSafe_ptr_Rep chunk = *(_MMSafe_ptr_Rep *)&chunk_ptr;
+    if (chunk.p == NULL) return NULL;
+
+    _MMSafe_ptr_Rep *link = chunk.p;
+    _MMSafe_ptr_Rep *slot = prev == NULL ? &region->head : prev->p;
+    *link = *slot;
+    *slot = chunk;
+    return slot;
+}
+
+/*
+ * Function: mm_region_array_alloc()
+ *
+ * Carve an object of size bytes from a region. The pointer to the object
+ * has the key of its chunk and the distance from the start of the chunk as
+ * its offset.
+ * */
+for_any(T) mm_array_ptr<T> mm_region_array_alloc(mm_region_t *region,
+                                                 size_t size) {
+    size = size == 0 ? 16 : (size + 15) & ~(size_t)15;
+
+    _MMSafe_ptr_Rep *chunk = &region->head;
+    char *obj = region->cur;
+    if (size > (size_t)(region->end - region->cur)) {
+        if (size > region->chunk_size / 4 && region->head.p != NULL) {
+            // The object gets a chunk of its own.
+            chunk = new_chunk(region, size + CHUNK_LINK, &region->head);
+            if (chunk == NULL) return NULL;
+            obj = (char *)chunk->p + CHUNK_LINK;
+        } else {
+            size_t chunk_size = region->chunk_size;
+            if (size + CHUNK_LINK > chunk_size) chunk_size = size + CHUNK_LINK;
+            if (new_chunk(region, chunk_size, NULL) == NULL) return NULL;
+            obj = (char *)region->head.p + CHUNK_LINK;
+            region->end = (char *)region->head.p + chunk_size;
+            region->cur = obj + size;
+        }
+    } else {
+        region->cur += size;
+    }
+
+    _MMSafe_ptr_Rep safe_ptr = {
+        .p = obj,
+        .key_offset = MM_ADD_OFFSET(chunk->key_offset, obj - (char *)chunk->p)
+    };
+    return *((mm_array_ptr<T> *)&safe_ptr);
+}
+
+for_any(T) mm_ptr<T> mm_region_alloc(mm_region_t *region, size_t size) {
+    mm_array_ptr<T> p = mm_region_array_alloc<T>(region, size);
+    return *((mm_ptr<T> *)&p);
+}
+
+/*
+ * Function: mm_region_destroy()
+ *
+ * Free all the chunks of a region. Freeing a chunk zeroes its lock, which
+ * invalidates every pointer to the objects in it.
+ * */
+void mm_region_destroy(mm_region_t *region) {
+    if (region == NULL) return;
+
+    _MMSafe_ptr_Rep chunk = region->head;
+    while (chunk.p != NULL) {
+        _MMSafe_ptr_Rep next = *(_MMSafe_ptr_Rep *)chunk.p;
+        mm_array_free<char>(*(mm_array_ptr<char> *)&chunk);
+        chunk = next;
+    }
+    free(region);
+}
@@ -0,0 +1,233 @@
+/** mm_slab.c - A size-class slab allocator for mmsafe heap objects.
+ *
+ * libsafemm_slab uses this allocator instead of malloc()/free() to back the
+ * memory of objects allocated by mm_alloc(), mm_array_alloc(), etc.
+ *
+ * All slabs are carved from one big virtual memory region that is reserved
+ * at the first allocation. Every slab is SLAB_SIZE bytes and serves blocks
+ * of exactly one size class. Because the region is contiguous, finding
+ * whether a block belongs to the slab allocator and which size class it is
+ * in only takes a range check and a table lookup; no per-block header is
+ * needed besides the one that libsafemm already puts in front of an object.
+ *
+ * The memory layout of an mmsafe object is not changed: the block returned
+ * by mm_slab_malloc() starts with the HEAP_PADDING word, followed by the lock
+ * and then the payload. A freed block is linked into the free list of its
+ * size class through its first word, so the (already invalidated) lock of a
+ * freed object stays zero until the block is reused.
+ *
+ * Requests larger than the biggest size class, and all requests after the
+ * region is exhausted, are forwarded to malloc().
+ * */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "mm_slab.h"
+
+/* 64 GB of virtual address space for slabs. */
+#define SLAB_REGION_SHIFT 36
+#define SLAB_REGION_SIZE (1UL << SLAB_REGION_SHIFT)
+/* Each slab is 256 KB. */
+#define SLAB_SHIFT 18
+#define SLAB_SIZE (1UL << SLAB_SHIFT)
+#define NUM_SLABS (SLAB_REGION_SIZE >> SLAB_SHIFT)
+
+/*
+ * Size classes: 16-byte spacing up to 256 bytes, then four classes between
+ * two consecutive powers of two up to MAX_SMALL_SIZE.
+ * */
+#define NUM_TINY_CLASSES 16
+#define TINY_MAX 256
+#define MAX_SMALL_SIZE (32 * 1024)
+#define NUM_CLASSES (NUM_TINY_CLASSES + (15 - 8) * 4)
+
+typedef struct {
+    volatile char lock;
+    void *free_list;
+    char *bump;
+    char *bump_end;
+} size_class_t;
+
+static size_class_t classes[NUM_CLASSES];
+
+static char *slab_base;
+static size_t next_slab;
+/* The size class of each slab plus one; 0 means the slab is not used yet. */
+static uint8_t slab_class[NUM_SLABS];
+
+static volatile char init_lock;
+static int initialized;
+
+static inline void spin_lock(volatile char *lock) {
+    while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE)) {
+        __builtin_ia32_pause();
+    }
+}
+
+static inline void spin_unlock(volatile char *lock) {
+    __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+//
+// Function: size_to_class()
+//
+// Map a request size (1 to MAX_SMALL_SIZE) to its size class.
+//
+static inline unsigned size_to_class(size_t size) {
+    if (size <= TINY_MAX) return (size + 15) / 16 - 1;
+
+    unsigned lg = 63 - __builtin_clzl(size - 1);
+    return NUM_TINY_CLASSES + (lg - 8) * 4 + (((size - 1) >> (lg - 2)) & 3);
+}
+
+//
+// Function: class_to_size()
+//
+// The block size of a size class.
+//
+static inline size_t class_to_size(unsigned cls) {
+    if (cls < NUM_TINY_CLASSES) return (cls + 1) * 16;
+
+    unsigned lg = 8 + (cls - NUM_TINY_CLASSES) / 4;
+    unsigned k = (cls - NUM_TINY_CLASSES) % 4;
+    return (1UL << lg) + (k + 1) * (1UL << (lg - 2));
+}
+
+//
+// Function: slab_init()
+//
+// Reserve the virtual memory region for all slabs. Pages are made accessible
+// one slab at a time when a size class needs a new slab.
+//
+static void slab_init(void) {
+    spin_lock(&init_lock);
+    if (!__atomic_load_n(&initialized, __ATOMIC_ACQUIRE)) {
+        void *region = mmap(NULL, SLAB_REGION_SIZE, PROT_NONE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        // If the reservation fails, every request goes to malloc().
+        slab_base = region == MAP_FAILED ? NULL : region;
+        __atomic_store_n(&initialized, 1, __ATOMIC_RELEASE);
+    }
+    spin_unlock(&init_lock);
+}
+
+//
+// Function: new_slab()
+//
+// Give a fresh slab to a size class. The caller must hold the class lock.
+//
+static int new_slab(size_class_t *c, unsigned cls) {
+    if (slab_base == NULL) return 0;
+
+    size_t idx = __atomic_fetch_add(&next_slab, 1, __ATOMIC_RELAXED);
+    if (idx >= NUM_SLABS) return 0;
+
+    char *slab = slab_base + (idx << SLAB_SHIFT);
+    if (mprotect(slab, SLAB_SIZE, PROT_READ | PROT_WRITE) != 0) return 0;
+
+    size_t block_size = class_to_size(cls);
+    slab_class[idx] = cls + 1;
+    c->bump = slab;
+    c->bump_end = slab + (SLAB_SIZE / block_size) * block_size;
+    return 1;
+}
+
+bool mm_slab_owns(void *p) {
+    return slab_base != NULL &&
+           (uintptr_t)p - (uintptr_t)slab_base < SLAB_REGION_SIZE;
+}
+
+size_t mm_slab_usable_size(void *p) {
+    return class_to_size(slab_class[((char *)p - slab_base) >> SLAB_SHIFT] - 1);
+}
+
+void *mm_slab_malloc(size_t size) {
+    if (size == 0 || size > MAX_SMALL_SIZE) return malloc(size);
+    if (!__atomic_load_n(&initialized, __ATOMIC_ACQUIRE)) slab_init();
+
+    unsigned cls = size_to_class(size);
+    size_class_t *c = &classes[cls];
+    size_t block_size = class_to_size(cls);
+    void *p = NULL;
+
+    spin_lock(&c->lock);
+    if (c->free_list != NULL) {
+        p = c->free_list;
+        c->free_list = *(void **)p;
+    } else if (c->bump + block_size <= c->bump_end || new_slab(c, cls)) {
+        p = c->bump;
+        c->bump += block_size;
+    }
+    spin_unlock(&c->lock);
+
+    return p != NULL ? p : malloc(size);
+}
+
+void *mm_slab_calloc(size_t size) {
+    void *p = mm_slab_malloc(size);
+    if (p != NULL) memset(p, 0, size);
+    return p;
+}
+
+static inline void free_to_class(void *p, unsigned cls) {
+    size_class_t *c = &classes[cls];
+
+    spin_lock(&c->lock);
+    *(void **)p = c->free_list;
+    c->free_list = p;
+    spin_unlock(&c->lock);
+}
+
+void mm_slab_free(void *p) {
+    if (!mm_slab_owns(p)) {
+        free(p);
+        return;
+    }
+
+    free_to_class(p, slab_class[((char *)p - slab_base) >> SLAB_SHIFT] - 1);
+}
+
+//
+// Function: mm_slab_free_sized()
+//
+// Free a block whose size is known to the caller. The size class is computed
+// from the size instead of being looked up in slab_class[], which saves a
+// likely cache miss per free. size must map to the class the block is in:
+// it is the size passed to mm_slab_malloc() or the last mm_slab_realloc().
+//
+void mm_slab_free_sized(void *p, size_t size) {
+    if (size == 0 || size > MAX_SMALL_SIZE || !mm_slab_owns(p)) {
+        free(p);
+        return;
+    }
+
+    free_to_class(p, size_to_class(size));
+}
+
+//
+// Function: mm_slab_realloc()
+//
+// A slab block is resized in place if the new size maps to the same size
+// class, so that mm_slab_free_sized() can still find the class from the new
+// size. Otherwise the content is moved to a new block. Blocks that came from
+// malloc() stay with realloc().
+//
+void *mm_slab_realloc(void *p, size_t size) {
+    if (p == NULL) return mm_slab_malloc(size);
+    if (!mm_slab_owns(p)) return realloc(p, size);
+
+    unsigned cls = slab_class[((char *)p - slab_base) >> SLAB_SHIFT] - 1;
+    if (size != 0 && size <= MAX_SMALL_SIZE && size_to_class(size) == cls) {
+        return p;
+    }
+
+    size_t old_size = class_to_size(cls);
+    void *new_p = mm_slab_malloc(size);
+    if (new_p == NULL) return NULL;
+    memcpy(new_p, p, old_size < size ? old_size : size);
+    mm_slab_free(p);
+    return new_p;
+}
@@ -0,0 +1,24 @@
+#ifndef MM_SLAB_H
+#define MM_SLAB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Size-class slab allocator used as the backing heap of libsafemm_slab.
+ * Requests larger than the biggest size class are forwarded to malloc().
+ * */
+void *mm_slab_malloc(size_t size);
+void *mm_slab_calloc(size_t size);
+void *mm_slab_realloc(void *p, size_t size);
+void mm_slab_free(void *p);
+/* Free a block of the given size without looking up its size class. */
+void mm_slab_free_sized(void *p, size_t size);
+
+/* Check if a block was handed out by the slab allocator. */
+bool mm_slab_owns(void *p);
+
+/* Number of usable bytes of a block returned by mm_slab_malloc(). */
+size_t mm_slab_usable_size(void *p);
+
+#endif
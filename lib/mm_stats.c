@@ -0,0 +1,160 @@
+/** mm_stats.c - Allocation statistics (see include/mm_stats.h).
+ *
+ * The counters of every running thread are on a list, so that a snapshot
+ * can add them up. When a thread exits, its counters are added to
+ * retired_counts and it leaves the list. Live bytes are kept in live_bytes
+ * and peak_live_bytes; a thread adds its share to them whenever it has
+ * drifted by MM_STATS_FOLD_BYTES.
+ * */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm_stats.h"
+#include "mm_counters.h"
+
+#ifdef MM_STATS
+
+__thread mm_thread_stats_t mm_thread_stats;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static mm_thread_stats_t *thread_list;
+static mm_stats_t retired_counts;
+static int64_t live_bytes;
+static int64_t peak_live_bytes;
+static pthread_key_t exit_key;
+
+static void update_peak(int64_t live) {
+    int64_t peak = __atomic_load_n(&peak_live_bytes, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&peak_live_bytes, &peak, live, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void mm_stats_fold_live(mm_thread_stats_t *ts) {
+    int64_t delta = ts->live_delta;
+    __atomic_store_n(&ts->live_delta, 0, __ATOMIC_RELAXED);
+    update_peak(__atomic_add_fetch(&live_bytes, delta, __ATOMIC_RELAXED));
+}
+
+/* Add the counters of src to dst. */
+static void add_counts(mm_stats_t *dst, const mm_stats_t *src) {
+    const uint64_t *s = (const uint64_t *)src;
+    uint64_t *d = (uint64_t *)dst;
+    for (size_t i = 0; i < sizeof(mm_stats_t) / sizeof(uint64_t); i++) {
+        d[i] += __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void thread_exit(void *arg) {
+    mm_thread_stats_t *ts = arg;
+    mm_stats_fold_live(ts);
+
+    pthread_mutex_lock(&stats_lock);
+    add_counts(&retired_counts, &ts->counts);
+    if (ts->prev != NULL) ts->prev->next = ts->next;
+    else thread_list = ts->next;
+    if (ts->next != NULL) ts->next->prev = ts->prev;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void write_stats_file(void) {
+    const char *path = getenv("MM_STATS");
+    if (path == NULL || path[0] == '\0') return;
+
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open the MM_STATS file %s.\n", path);
+        return;
+    }
+    mm_stats_write_json(out);
+    fclose(out);
+}
+
+__attribute__((constructor))
+static void stats_init(void) {
+    if (pthread_key_create(&exit_key, thread_exit) != 0) {
+        fprintf(stderr, "Failed to set up the allocation statistics.\n");
+        abort();
+    }
+    atexit(write_stats_file);
+}
+
+void mm_stats_register_thread(void) {
+    mm_thread_stats_t *ts = &mm_thread_stats;
+    ts->registered = 1;
+
+    pthread_mutex_lock(&stats_lock);
+    ts->prev = NULL;
+    ts->next = thread_list;
+    if (thread_list != NULL) thread_list->prev = ts;
+    thread_list = ts;
+    pthread_mutex_unlock(&stats_lock);
+
+    // The main thread does not run key destructors; its counters are read
+    // from the list at exit.
+    pthread_setspecific(exit_key, ts);
+}
+
+void mm_stats_snapshot(mm_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    int64_t live = __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&stats_lock);
+    add_counts(stats, &retired_counts);
+    for (mm_thread_stats_t *ts = thread_list; ts != NULL; ts = ts->next) {
+        add_counts(stats, &ts->counts);
+        live += __atomic_load_n(&ts->live_delta, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    int64_t peak = __atomic_load_n(&peak_live_bytes, __ATOMIC_RELAXED);
+    stats->live_bytes = live > 0 ? live : 0;
+    stats->peak_live_bytes = live > peak ? live : peak;
+}
+
+#else
+
+void mm_stats_snapshot(mm_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+#endif
+
+void mm_stats_write_json(FILE *out) {
+    mm_stats_t stats;
+    mm_stats_snapshot(&stats);
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"allocs\": %llu,\n", (unsigned long long)stats.allocs);
+    fprintf(out, "  \"frees\": %llu,\n", (unsigned long long)stats.frees);
+    fprintf(out, "  \"reallocs_in_place\": %llu,\n",
+            (unsigned long long)stats.reallocs_in_place);
+    fprintf(out, "  \"reallocs_moved\": %llu,\n",
+            (unsigned long long)stats.reallocs_moved);
+    fprintf(out, "  \"calloc_bytes\": %llu,\n",
+            (unsigned long long)stats.calloc_bytes);
+    fprintf(out, "  \"alloc_bytes\": %llu,\n",
+            (unsigned long long)stats.alloc_bytes);
+    fprintf(out, "  \"live_bytes\": %llu,\n",
+            (unsigned long long)stats.live_bytes);
+    fprintf(out, "  \"peak_live_bytes\": %llu,\n",
+            (unsigned long long)stats.peak_live_bytes);
+    fprintf(out, "  \"meta_bytes\": %llu,\n",
+            (unsigned long long)stats.meta_bytes);
+
+    // The histogram as {"lower bound of a size class": count}, without the
+    // empty classes.
+    fprintf(out, "  \"size_hist\": {");
+    const char *sep = "";
+    for (int i = 0; i < MM_STATS_SIZE_CLASSES; i++) {
+        if (stats.size_hist[i] == 0) continue;
+        fprintf(out, "%s\"%llu\": %llu", sep, i == 0 ? 0ULL : 1ULL << i,
+                (unsigned long long)stats.size_hist[i]);
+        sep = ", ";
+    }
+    fprintf(out, "}\n}\n");
+}
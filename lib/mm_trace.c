@@ -0,0 +1,275 @@
+/** mm_trace.c - Binary tracing of heap operations (see include/mm_trace.h).
+ *
+ * Every thread that has traced an operation owns a ring buffer. The thread
+ * is the only one that moves the head of its ring, and the writer thread
+ * the only one that moves the tail, so neither takes a lock. Every
+ * TRACE_FLUSH_NS the writer appends what is between the tail and the head
+ * of every ring to the trace file, with write() so that a forked child
+ * cannot flush a copy of buffered data. The rings are on a list that is
+ * only locked to add, drain, and remove rings. A ring outlives its thread
+ * until the writer has drained it.
+ *
+ * By default a thread whose ring is full drops the record. With
+ * MM_TRACE_LOSSLESS=1 it waits for the writer instead, which slows the
+ * program down but records every operation, e.g., for a trace that is
+ * going to be replayed (eval/microbench/replay_bench.c). The writer does
+ * not sleep between drains while rings fill up quickly.
+ * */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "mm_trace.h"
+#include "mm_counters.h"
+
+#define RING_RECORDS 8192  /* Must be a power of 2. */
+#define TRACE_FLUSH_NS (10 * 1000 * 1000)
+
+typedef struct ring {
+    mm_trace_record_t records[RING_RECORDS];
+    uint64_t head;
+    uint64_t tail;
+    uint64_t dropped;           /* Records the thread could not add. */
+    uint64_t dropped_reported;  /* The part of dropped that is in the file. */
+    uint32_t tid;
+    int dead;                   /* Set when the thread exits. */
+    struct ring *next;
+} ring_t;
+
+int mm_trace_on;
+
+static __thread ring_t *thread_ring;
+static ring_t *ring_list;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t exit_key;
+
+/* Starting and stopping are serialized by control_lock. */
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+static int trace_fd = -1;
+static pthread_t writer;
+static int writer_running;
+static int writer_stop;
+static int trace_lossless;
+
+static inline uint64_t read_tsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static void thread_exit(void *arg) {
+    __atomic_store_n(&((ring_t *)arg)->dead, 1, __ATOMIC_RELEASE);
+}
+
+static ring_t *new_ring(void) {
+    ring_t *r = calloc(1, sizeof(ring_t));
+    if (r == NULL) return NULL;
+    r->tid = (uint32_t)syscall(SYS_gettid);
+
+    pthread_mutex_lock(&ring_lock);
+    r->next = ring_list;
+    ring_list = r;
+    pthread_mutex_unlock(&ring_lock);
+
+    pthread_setspecific(exit_key, r);
+    thread_ring = r;
+    return r;
+}
+
+void mm_trace_event(uint32_t op, void *ptr, uint64_t key, uint64_t size,
+                    uint64_t aux) {
+    ring_t *r = thread_ring;
+    if (r == NULL && (r = new_ring()) == NULL) return;
+
+    uint64_t head = r->head;
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_RECORDS) {
+        if (!trace_lossless ||
+            !__atomic_load_n(&mm_trace_on, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+        sched_yield();
+    }
+
+    mm_trace_record_t *rec = &r->records[head & (RING_RECORDS - 1)];
+    rec->tsc = read_tsc();
+    rec->op = op;
+    rec->tid = r->tid;
+    rec->ptr = (uintptr_t)ptr;
+    rec->key = key;
+    rec->size = size;
+    rec->aux = aux;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void write_all(const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(trace_fd, p, len);
+        if (n <= 0) return;
+        p += n;
+        len -= n;
+    }
+}
+
+static void write_record(uint32_t op, uint32_t tid, uint64_t tsc,
+                         uint64_t size) {
+    mm_trace_record_t rec = { tsc, op, tid, 0, 0, size, 0 };
+    write_all(&rec, sizeof(rec));
+}
+
+/* Write out the records of r. Return how many there were. */
+static uint64_t drain_ring(ring_t *r) {
+    uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = r->tail;
+    uint64_t count = head - tail;
+    while (tail != head) {
+        uint64_t i = tail & (RING_RECORDS - 1);
+        uint64_t n = head - tail;
+        if (n > RING_RECORDS - i) n = RING_RECORDS - i;
+        write_all(&r->records[i], sizeof(mm_trace_record_t) * n);
+        tail += n;
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+    uint64_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    if (dropped != r->dropped_reported) {
+        write_record(MM_TRACE_DROPPED, r->tid, read_tsc(),
+                     dropped - r->dropped_reported);
+        r->dropped_reported = dropped;
+    }
+    return count;
+}
+
+/* Write out every ring, and free the rings of the threads that are gone.
+ * Return the largest number of records that a ring had. */
+static uint64_t drain_all(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    write_record(MM_TRACE_CLOCK, 0, read_tsc(),
+                 ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+
+    uint64_t most = 0;
+    pthread_mutex_lock(&ring_lock);
+    ring_t **link = &ring_list;
+    while (*link != NULL) {
+        ring_t *r = *link;
+        int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+        uint64_t count = drain_ring(r);
+        if (count > most) most = count;
+        if (dead) {
+            *link = r->next;
+            free(r);
+        } else {
+            link = &r->next;
+        }
+    }
+    pthread_mutex_unlock(&ring_lock);
+    return most;
+}
+
+static void *writer_main(void *arg) {
+    struct timespec interval = { 0, TRACE_FLUSH_NS };
+    while (!__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE)) {
+        if (drain_all() < RING_RECORDS / 4) nanosleep(&interval, NULL);
+    }
+    drain_all();
+    return NULL;
+}
+
+/* A forked child has no writer thread; it stops tracing and leaves the file
+ * to the parent. */
+static void child_after_fork(void) {
+    __atomic_store_n(&mm_trace_on, 0, __ATOMIC_RELAXED);
+    if (trace_fd >= 0) close(trace_fd);
+    trace_fd = -1;
+    writer_running = 0;
+}
+
+static void trace_setup(void) {
+    if (pthread_key_create(&exit_key, thread_exit) != 0) {
+        fprintf(stderr, "Failed to set up tracing.\n");
+        abort();
+    }
+    pthread_atfork(NULL, NULL, child_after_fork);
+    atexit(mm_trace_stop);
+}
+
+int mm_trace_start(const char *path) {
+    pthread_once(&setup_once, trace_setup);
+
+    pthread_mutex_lock(&control_lock);
+    if (writer_running) {
+        pthread_mutex_unlock(&control_lock);
+        return -1;
+    }
+
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (trace_fd < 0) {
+        fprintf(stderr, "Failed to open the trace file %s.\n", path);
+        pthread_mutex_unlock(&control_lock);
+        return -1;
+    }
+    mm_trace_header_t header = { MM_TRACE_MAGIC, 1,
+                                 sizeof(mm_trace_record_t) };
+    write_all(&header, sizeof(header));
+
+    // Forget what is left from an earlier trace.
+    pthread_mutex_lock(&ring_lock);
+    for (ring_t *r = ring_list; r != NULL; r = r->next) {
+        __atomic_store_n(&r->tail, __atomic_load_n(&r->head, __ATOMIC_ACQUIRE),
+                         __ATOMIC_RELEASE);
+        r->dropped_reported = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    __atomic_store_n(&writer_stop, 0, __ATOMIC_RELEASE);
+    if (pthread_create(&writer, NULL, writer_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start the trace writer.\n");
+        close(trace_fd);
+        trace_fd = -1;
+        pthread_mutex_unlock(&control_lock);
+        return -1;
+    }
+    writer_running = 1;
+    __atomic_store_n(&mm_trace_on, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&control_lock);
+    return 0;
+}
+
+void mm_trace_stop(void) {
+    pthread_mutex_lock(&control_lock);
+    if (writer_running) {
+        __atomic_store_n(&mm_trace_on, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(writer, NULL);
+        close(trace_fd);
+        trace_fd = -1;
+        writer_running = 0;
+    }
+    pthread_mutex_unlock(&control_lock);
+}
+
+__attribute__((constructor))
+static void trace_init(void) {
+    const char *lossless = getenv("MM_TRACE_LOSSLESS");
+    trace_lossless = lossless != NULL && atoi(lossless) != 0;
+    const char *path = getenv("MM_TRACE");
+    if (path != NULL && path[0] != '\0') mm_trace_start(path);
+}
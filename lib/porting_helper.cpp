@@ -13,16 +13,66 @@
 // The second situation happens when we extracts the raw pointer of an mmsafe
 // pointer and assigns to a raw pointer that has not beend ported.
 //
+// The raw pointers of all live mmsafe objects are recorded in a shadow bitmap
+// with one bit per 16-byte granule of the address space (the raw pointer of
+// an mmsafe object is always 16-byte aligned). The bitmap is split into
+// chunks that each cover 4 GB of address space; a chunk is mapped the first
+// time a pointer in its range is inserted, and its pages are only backed by
+// physical memory where the heap actually is. Lookups, inserts, and erases
+// are a couple of shifts and one atomic bit operation, and they are safe to
+// call from multiple threads.
+//
 
 #include "porting_helper.h"
-#include <unordered_set>
+#include <atomic>
 #include <cstdint>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
 using namespace std;
 
-unordered_set<void*> mmsafe_ptrs;
+#define GRANULE_SHIFT 4
+#define CHUNK_SHIFT 32
+#define ADDR_BITS 48
+#define NUM_CHUNKS (1UL << (ADDR_BITS - CHUNK_SHIFT))
+// One bit per granule.
+#define CHUNK_BYTES (1UL << (CHUNK_SHIFT - GRANULE_SHIFT - 3))
+
+static atomic<uint64_t *> shadow_chunks[NUM_CHUNKS];
+
+// Get the bitmap chunk that covers p. Map it first if create is true.
+static uint64_t *get_chunk(uintptr_t p, bool create) {
+  if (p >> ADDR_BITS) return nullptr;
+
+  atomic<uint64_t *> &slot = shadow_chunks[p >> CHUNK_SHIFT];
+  uint64_t *chunk = slot.load(memory_order_acquire);
+  if (chunk != nullptr || !create) return chunk;
+
+  void *mem = mmap(nullptr, CHUNK_BYTES, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "Failed to map the shadow bitmap of mmsafe pointers.\n");
+    abort();
+  }
+
+  // Another thread may have mapped the same chunk in the meantime.
+  uint64_t *expected = nullptr;
+  if (!slot.compare_exchange_strong(expected, (uint64_t *)mem,
+                                    memory_order_acq_rel)) {
+    munmap(mem, CHUNK_BYTES);
+    return expected;
+  }
+  return (uint64_t *)mem;
+}
+
+// The bitmap word that holds the bit of p, and the mask of that bit.
+static inline atomic<uint64_t> *get_word(uint64_t *chunk, uintptr_t p,
+                                         uint64_t *mask) {
+  uintptr_t granule = (p & ((1UL << CHUNK_SHIFT) - 1)) >> GRANULE_SHIFT;
+  *mask = 1UL << (granule & 63);
+  return reinterpret_cast<atomic<uint64_t> *>(chunk + (granule >> 6));
+}
 
 #if defined __cplusplus
 extern "C" {
@@ -31,17 +81,34 @@ extern "C" {
 
 // Check if a pointer is the raw ptr of an mmsafe pointer.
 bool is_an_mmsafe_ptr(void *p) {
-  return mmsafe_ptrs.find(p) != mmsafe_ptrs.end();
+  uintptr_t addr = (uintptr_t)p;
+  if (addr & ((1UL << GRANULE_SHIFT) - 1)) return false;
+
+  uint64_t *chunk = get_chunk(addr, false);
+  if (chunk == nullptr) return false;
+
+  uint64_t mask;
+  return get_word(chunk, addr, &mask)->load(memory_order_relaxed) & mask;
 }
 
 // Insert the raw pointer of an mmsafe pointer in the mmsafe pointer set.
 void insert_mmsafe_ptr(void *p) {
-  mmsafe_ptrs.insert(p);
+  uintptr_t addr = (uintptr_t)p;
+  uint64_t *chunk = get_chunk(addr, true);
+  if (chunk == nullptr) return;
+
+  uint64_t mask;
+  get_word(chunk, addr, &mask)->fetch_or(mask, memory_order_relaxed);
 }
 
 // Erase the raw pointer of an mmsafe pointer from the mmsafe pointer set.
 void erase_mmsafe_ptr(void *p) {
-  mmsafe_ptrs.erase(p);
+  uintptr_t addr = (uintptr_t)p;
+  uint64_t *chunk = get_chunk(addr, false);
+  if (chunk == nullptr) return;
+
+  uint64_t mask;
+  get_word(chunk, addr, &mask)->fetch_and(~mask, memory_order_relaxed);
 }
 
 // Use this to replace original free() calls. This will handle the case when
@@ -57,10 +124,10 @@ void uncertain_free(void *p) {
 #endif
 
     // From calling free() on the raw pointer of an mmsafe pointer.
-    // Invalidate the lock and then do the real free.
-    *((uint32_t *)((char *)p - 8)) = 0;
+    // Invalidate the lock and then do the real free. The runtime does
+    // both because the object may live on a heap other than libc's.
     erase_mmsafe_ptr(p);
-    free((char *)p - 16);
+    mm_free_raw(p);
   } else {
 #ifdef MM_DEBUG
   fprintf(stdout, "[uncertain_free  ] Freeing a raw ptr %p\n", p);
@@ -10,6 +10,13 @@ void insert_mmsafe_ptr(void *p);
 void erase_mmsafe_ptr(void *p);
 void uncertain_free(void *p);
 
+/*
+ * Defined in safe_mm_checked.c. Release an mmsafe object by its raw pointer.
+ * Not available in libsafemm_locktable, where a raw pointer does not lead to
+ * the lock of its object.
+ * */
+void mm_free_raw(void *p);
+
 #if defined __cplusplus
 }
 #endif
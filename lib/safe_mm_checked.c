@@ -4,15 +4,15 @@
  * customized memory allocators and deallocators for memory objects pointed
  * by mm_ptr and mm_array_ptr.
  *
- * @note The current implementation uses a 32-32 key-offset metadata
- * design for mmsafe ptr. Supporting different key-offset allotment, as described
- * in the OOPSLA23 paper, is in future work.
+ * @note The default is a 32-32 key-offset metadata design for mmsafe ptr.
+ * The 40-24 allotment and the offset-key order, as described in the OOPSLA23
+ * paper, are selected at build time (see mm_layout.h).
  * 
  * Furthermore, it is not totally clear to us which is faster: key-offset or
  * offset-key. For the 32-32 option it might be the same but the key-offset one
  * might be a little faster for the 40-24 allotment because the constant used
  * in an "and" instruction can be hardcoded in the instruction instead of
- * loading from another register.
+ * loading from another register. eval/microbench/layout_bench.c measures it.
  *
  * */
 
@@ -21,43 +21,359 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <malloc.h>      /* for malloc_usable_size() */
+#include <pthread.h>
 #include <immintrin.h>   /* for _rdrand32_step() */
 
 #include "safe_mm_checked.h"
 #include "porting_helper.h"
+#include "mm_large.h"
+#include "mm_object.h"
+#include "mm_counters.h"
+#include "mm_defer.h"
+
+#ifdef MM_LOCK_TABLE
+#ifdef PORTING
+// The raw pointer of an object does not lead to its lock anymore, so a raw
+// pointer passed to free() cannot be invalidated.
+#error "The lock table does not support PORTING."
+#endif
+#endif
 
 #define __INLINE __attribute__((always_inline))
 
-/* The real lock size is 4 bytes but we allocate 8 bytes for it for alignment. */
-#define LOCK_MEM 8
-#define HEAP_PADDING 8
-#define EXTRA_HEAP_MEM 16
-#define KEY_MASK 0x00000000ffffffff
+/*
+ * The heap that backs mmsafe objects. By default it is the libc heap;
+ * libsafemm_slab (built with MM_SLAB) uses the size-class slab allocator
+ * in mm_slab.c instead. The layout of an object is the same for both.
+ * */
+#ifdef MM_SLAB
+#include "mm_slab.h"
+#define heap_malloc(size) mm_slab_malloc(size)
+#define heap_calloc(size) mm_slab_calloc(size)
+#define heap_realloc(p, size) mm_slab_realloc(p, size)
+#define heap_free(p) mm_slab_free(p)
+#define heap_free_sized(p, size) mm_slab_free_sized(p, size)
+#else
+#define heap_malloc(size) malloc(size)
+#define heap_calloc(size) calloc(1, size)
+#define heap_realloc(p, size) realloc(p, size)
+#define heap_free(p) free(p)
+#define heap_free_sized(p, size) free(p)
+#endif
 
-#define GET_KEY(key_offset) (uint32_t)(key_offset >> 32)
-#define GET_OFFSET(key_offset) (key_offset & KEY_MASK)
+#ifdef MM_SLAB
+#define heap_usable_size(p) \
+    (mm_slab_owns(p) ? mm_slab_usable_size(p) : malloc_usable_size(p))
+#else
+#define heap_usable_size(p) malloc_usable_size(p)
+#endif
 
-// A helper struct that has the same inner structure as an mmsafe ptr.
-typedef struct {
-  void *p;
-  uint64_t key_offset;
-} _MMSafe_ptr_Rep;
+#ifndef MM_LOCK_TABLE
+/*
+ * The per-thread cache of free blocks (see safe_mm_checked.h). new_object()
+ * and the inline allocation fast path take blocks of up to
+ * MM_INLINE_MAX_BLOCK bytes from it, and frees put them back, so most small
+ * objects are recycled without going to the heap: a free only zeroes the
+ * lock and pushes the block, and an allocation pops it and writes a new key.
+ * A refill takes TCACHE_REFILL blocks from the heap; when a size class is
+ * full, a freed block goes straight back to the heap, so that a long run
+ * of frees does not go through the cache and then the heap. Build with
+ * MM_NO_TCACHE to leave new_object() on the heap (libsafemm_notcache).
+ *
+ * The thread whose cache took a block from the heap owns it. With 32-bit
+ * keys, the index of the owner is in the unused upper half of the lock slot
+ * of the block (MM_BLOCK_OWNER()). A thread that frees a block of another
+ * thread pushes it on a lock-free list of the owner, and the owner takes
+ * the whole list when it runs out of blocks of that size, so that the
+ * blocks of a producer that other threads free do not pile up in their
+ * caches. When a thread exits, its cache and its lists go back to the heap
+ * and its index goes to the next new thread, along with the blocks that
+ * are freed to it later. With 40-bit keys, a block stays with the thread
+ * that frees it.
+ * */
+#define TCACHE_REFILL 32
+#define TCACHE_MAX_OWNERS 1024
+
+#ifndef MM_NO_TCACHE
+#define TCACHE_ALLOC
+#endif
+
+__thread mm_tcache_t mm_tcache;
+__thread uint32_t mm_tcache_owner;
+static __thread int tcache_ready;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+#if MM_TCACHE_OWNERS
+/* The blocks that other threads freed, by owner and size class. */
+static void *remote_free[TCACHE_MAX_OWNERS][MM_INLINE_CLASSES];
+static uint32_t free_owners[TCACHE_MAX_OWNERS];
+static uint32_t num_free_owners;
+static uint32_t next_owner = 1;
+static pthread_mutex_t owner_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static inline void tcache_push(unsigned cls, void *block) {
+    *(void **)block = mm_tcache.head[cls];
+    mm_tcache.head[cls] = block;
+    mm_tcache.count[cls]++;
+}
+
+static inline void *tcache_pop(unsigned cls) {
+    void *block = mm_tcache.head[cls];
+    if (block != NULL) {
+        mm_tcache.head[cls] = *(void **)block;
+        mm_tcache.count[cls]--;
+    }
+    return block;
+}
+
+static void free_list(void *block, unsigned cls) {
+    while (block != NULL) {
+        void *next = *(void **)block;
+        heap_free_sized(block, (cls + 1) * 16);
+        block = next;
+    }
+}
+
+//
+// Function: tcache_release()
+//
+// Give the cache of an exiting thread back to the heap.
+//
+static void tcache_release(void *arg) {
+    for (unsigned cls = 0; cls < MM_INLINE_CLASSES; cls++) {
+        free_list(mm_tcache.head[cls], cls);
+        mm_tcache.head[cls] = NULL;
+        mm_tcache.count[cls] = 0;
+    }
+#if MM_TCACHE_OWNERS
+    uint32_t owner = mm_tcache_owner;
+    if (owner != 0) {
+        for (unsigned cls = 0; cls < MM_INLINE_CLASSES; cls++) {
+            free_list(__atomic_exchange_n(&remote_free[owner][cls], NULL,
+                                          __ATOMIC_ACQUIRE), cls);
+        }
+        pthread_mutex_lock(&owner_lock);
+        free_owners[num_free_owners++] = owner;
+        pthread_mutex_unlock(&owner_lock);
+        mm_tcache_owner = 0;
+    }
+#endif
+    tcache_ready = 0;
+}
+
+static void tcache_create_key(void) {
+    if (pthread_key_create(&tcache_key, tcache_release) != 0) {
+        fprintf(stderr, "Failed to set up the thread cache.\n");
+        abort();
+    }
+}
 
-#if 1
-// Our current implementation uses a 32-bit key. We may need to change it
-// to 40-bit key later.
-uint32_t key = 3;
+//
+// Function: tcache_setup()
+//
+// Get an owner index for the current thread and make sure that its cache
+// is released when it exits.
+//
+__attribute__ ((noinline))
+static void tcache_setup(void) {
+    pthread_once(&tcache_once, tcache_create_key);
+#if MM_TCACHE_OWNERS
+    pthread_mutex_lock(&owner_lock);
+    if (num_free_owners > 0) {
+        mm_tcache_owner = free_owners[--num_free_owners];
+    } else if (next_owner < TCACHE_MAX_OWNERS) {
+        mm_tcache_owner = next_owner++;
+    }
+    pthread_mutex_unlock(&owner_lock);
+#endif
+    pthread_setspecific(tcache_key, &mm_tcache);
+    tcache_ready = 1;
+}
+
+//
+// Function: tcache_refill()
+//
+// Take back the blocks of size class cls that other threads freed, or take
+// new blocks from the heap.
+//
+__attribute__ ((noinline))
+static void tcache_refill(unsigned cls) {
+    if (!tcache_ready) tcache_setup();
+
+#if MM_TCACHE_OWNERS
+    uint32_t owner = mm_tcache_owner;
+    if (owner != 0 &&
+        __atomic_load_n(&remote_free[owner][cls], __ATOMIC_RELAXED) != NULL) {
+        void *block = __atomic_exchange_n(&remote_free[owner][cls], NULL,
+                                          __ATOMIC_ACQUIRE);
+        while (block != NULL) {
+            void *next = *(void **)block;
+            tcache_push(cls, block);
+            block = next;
+        }
+        if (mm_tcache.head[cls] != NULL) return;
+    }
+#endif
+
+    // Push the new blocks in reverse, so that they are handed out in the
+    // order in which the heap gave them.
+    size_t block_size = (cls + 1) * 16;
+    void *blocks[TCACHE_REFILL];
+    int n = 0;
+    while (n < TCACHE_REFILL && (blocks[n] = heap_malloc(block_size)) != NULL) {
+#if MM_TCACHE_OWNERS
+        MM_BLOCK_OWNER(blocks[n]) = owner;
+#endif
+        n++;
+    }
+    while (n > 0) tcache_push(cls, blocks[--n]);
+}
+
+//
+// Function: tcache_free()
+//
+// Put a free block (with its lock already zeroed) back to the cache of its
+// owner, or back to the heap if the size class of the cache is full.
+//
+__INLINE
+static inline void tcache_free(void *block, unsigned cls) {
+#if MM_TCACHE_OWNERS
+    uint32_t owner = MM_BLOCK_OWNER(block);
+    if (owner != mm_tcache_owner && owner != 0) {
+        void **head = &remote_free[owner][cls];
+        void *old = __atomic_load_n(head, __ATOMIC_RELAXED);
+        do {
+            *(void **)block = old;
+        } while (!__atomic_compare_exchange_n(head, &old, block, true,
+                                              __ATOMIC_RELEASE,
+                                              __ATOMIC_RELAXED));
+        return;
+    }
+#endif
+    if (__builtin_expect(!tcache_ready, 0)) tcache_setup();
+    if (mm_tcache.count[cls] >= MM_INLINE_CACHE_LIMIT) {
+        heap_free_sized(block, (cls + 1) * 16);
+        return;
+    }
+    tcache_push(cls, block);
+}
 #endif
 
+/*
+ * Release the memory of an object, given its payload and its info word.
+ * The size in the info word is passed down to the heap, so that the slab
+ * allocator does not have to look up the size class of the block.
+ * */
+__INLINE
+static inline void payload_free(void *payload, uint64_t info) {
+    if (info & MM_LARGE_TAG) {
+        mm_large_free(payload - LARGE_HEADER);
+#ifndef MM_LOCK_TABLE
+    } else if (info & MM_INLINE_TAG) {
+        tcache_free(payload - EXTRA_HEAP_MEM,
+                    MM_INFO_FLAGS(info) >> MM_INLINE_CLASS_SHIFT);
+#endif
+    } else {
+        heap_free_sized(payload - EXTRA_HEAP_MEM,
+                        MM_INFO_SIZE(info) + EXTRA_HEAP_MEM);
+    }
+}
+
+void mm_payload_free(void *payload, uint64_t info) {
+    payload_free(payload, info);
+}
+
+/* The header and lock table bytes of an object, for the statistics. */
+#ifdef MM_LOCK_TABLE
+#define TABLE_META_BYTES (sizeof(mm_key_t) + sizeof(mm_slot_t))
+#else
+#define TABLE_META_BYTES 0
+#endif
+#define OBJ_META_BYTES(info) \
+    (((info) & MM_LARGE_TAG ? LARGE_HEADER : EXTRA_HEAP_MEM) + TABLE_META_BYTES)
+
+/* Counters of mm_array_realloc() calls that resized an existing object. */
+static mm_realloc_stats_t realloc_stats;
+
+#define GET_KEY(key_offset) MM_GET_KEY(key_offset)
+#define GET_OFFSET(key_offset) MM_GET_OFFSET(key_offset)
+
+/*
+ * Key generation.
+ *
+ * Keys are unique across all threads. Instead of bumping one shared counter
+ * for every allocation, each thread claims a block of KEY_BLOCK_SIZE keys
+ * from the shared counter with one atomic add and then hands out the keys of
+ * its block without any synchronization.
+ *
+ * The shared counter is 64 bits wide so that it never wraps. A key is the
+ * lower MM_KEY_BITS bits of a counter value. Blocks never straddle a
+ * wraparound of the key, and keys 0, 1, and 2 are skipped when a block
+ * starts at the beginning of the key space.
+ *
+ * The width of a key (32 or 40 bits) depends on the metadata layout.
+ * */
+#define KEY_BLOCK_SIZE 4096
+#define KEY_SPACE (1ULL << MM_KEY_BITS)
+/* 0, 1, and 2 are reserved for invalid key, stack, and global variables. */
+#define FIRST_VALID_KEY 3
+
+static uint64_t key_counter = FIRST_VALID_KEY;
+
+/*
+ * The unused keys [mm_thread_key, mm_thread_key_end) of the current thread.
+ * They are visible to the inline allocation fast path in safe_mm_checked.h.
+ * */
+__thread mm_key_t mm_thread_key;
+__thread mm_key_t mm_thread_key_end;
+
+//
+// Function: refill_keys()
+//
+// Claim a new block of keys for the current thread.
+//
+__attribute__ ((noinline))
+static void refill_keys() {
+    uint64_t start = __atomic_fetch_add(&key_counter, KEY_BLOCK_SIZE,
+                                        __ATOMIC_RELAXED);
+    uint64_t end = start + KEY_BLOCK_SIZE;
+
+    // Do not let a block cross the wraparound point of the key.
+    uint64_t wrap = (start & ~(KEY_SPACE - 1)) + KEY_SPACE;
+    if (end > wrap) end = wrap;
+    if ((start & (KEY_SPACE - 1)) < FIRST_VALID_KEY) {
+        start = (start & ~(KEY_SPACE - 1)) + FIRST_VALID_KEY;
+    }
+
+    mm_thread_key = (mm_key_t)(start & (KEY_SPACE - 1));
+    // For 32-bit keys, if the block ends exactly at the wraparound point,
+    // mm_thread_key_end is 0 and mm_thread_key reaches it by overflowing.
+    mm_thread_key_end = mm_thread_key + (mm_key_t)(end - start);
+}
+
+//
+// Function: next_key()
+//
+// Get a fresh key for a new object or a new stack frame.
+//
+__INLINE
+static inline mm_key_t next_key() {
+    if (__builtin_expect(mm_thread_key == mm_thread_key_end, 0)) refill_keys();
+    return mm_thread_key++;
+}
+
 /*
  * print_ptr_info().
  *
  * For debugging purpose.
  * */
 __INLINE
-static void print_ptr_info(char *caller, void *p, uint32_t key) {
+static void print_ptr_info(char *caller, void *p, mm_key_t key) {
 #ifdef MM_DEBUG
-    printf("[%-16s] ptr = %p, key = %u\n", caller, p, key);
+    printf("[%-16s] ptr = %p, key = %llu\n", caller, p, (unsigned long long)key);
 #endif
 }
 
@@ -92,9 +408,9 @@ static uint32_t rand_keygen() {
 /*
  * Function: mm_initKey()
  *
- * Create the initial key for a program. All subsequent allocations just
- * increase the key by 1. Call to this function is inserted by the compiler
- * at the beginning of the main function.
+ * Create the initial key for a program. All subsequent key blocks are
+ * claimed upwards from it. Call to this function is inserted by the compiler
+ * at the beginning of the main function, before any other thread exists.
  *
  * Jie Zhou: For some unknow reason, if we add __INLINE to this function,
  * and use LTO for Olden benchmarks, the cmake configuration procedure
@@ -102,7 +418,9 @@ static uint32_t rand_keygen() {
  * error while using the compiler to compile a temporary test program.
  * */
 void mm_init_key() {
-    key = rand_keygen();
+    __atomic_store_n(&key_counter, rand_keygen(), __ATOMIC_RELAXED);
+    // Drop the keys that the main thread may have claimed before.
+    mm_thread_key = mm_thread_key_end = 0;
 }
 
 /**
@@ -113,8 +431,96 @@ void mm_init_key() {
  *
  * */
 __INLINE
-uint32_t mm_get_new_key() {
-    return key++;
+mm_key_t mm_get_new_key() {
+    return next_key();
+}
+
+//
+// Function: new_object()
+//
+// Allocate an object of size bytes with a fresh key. Return the mmsafe
+// pointer to it, or a null pointer if there is no memory.
+//
+// Objects of at least mm_large_threshold bytes (including the header) get
+// their own mapping (see mm_large.c). Every other object comes from the
+// heap; its info word holds its size and no flags.
+//
+__INLINE
+static inline _MMSafe_ptr_Rep new_object(size_t size, bool zero) {
+    _MMSafe_ptr_Rep obj = { NULL, 0 };
+    void *payload;
+    uint64_t info;
+    if (size + LARGE_HEADER >= mm_large_threshold) {
+        void *block = mm_large_alloc(size + LARGE_HEADER);
+        if (block == NULL) return obj;
+        payload = block + LARGE_HEADER;
+        info = *(uint64_t *)block;
+#ifdef TCACHE_ALLOC
+    } else if (size + EXTRA_HEAP_MEM <= MM_INLINE_MAX_BLOCK) {
+        unsigned cls = (size + EXTRA_HEAP_MEM + 15) / 16 - 1;
+        if (mm_tcache.head[cls] == NULL) tcache_refill(cls);
+        void *block = tcache_pop(cls);
+        if (block == NULL) return obj;
+        payload = block + EXTRA_HEAP_MEM;
+        if (zero) memset(payload, 0, size);
+        info = MM_MAKE_INFO(size, MM_INLINE_TAG |
+                                  ((uint64_t)cls << MM_INLINE_CLASS_SHIFT));
+#endif
+    } else {
+        // We need the HEAP_PADDING to ensure that mm_ptr inside a struct
+        // is aligned by 16 bytes.
+        // See this issue for the reason: https://github.com/jzhou76/checkedc-llvm/issues/2
+        size_t block_size = size + EXTRA_HEAP_MEM;
+        void *block = zero ? heap_calloc(block_size) : heap_malloc(block_size);
+        if (block == NULL) return obj;
+        payload = block + EXTRA_HEAP_MEM;
+        info = MM_MAKE_INFO(size, 0);
+    }
+
+    mm_key_t key = next_key();
+#ifdef MM_LOCK_TABLE
+    uint64_t slot = mm_slot_alloc();
+    if (slot == 0) {
+        payload_free(payload, info);
+        return obj;
+    }
+    mm_slot_table[slot].base = payload;
+#else
+    uint64_t slot = 0;
+#endif
+
+    obj.p = payload;
+    obj.key_offset = MM_MAKE_KEY_OFFSET(key, slot);
+    *OBJ_INFO(obj) = info;
+    *OBJ_LOCK(obj) = key;
+    mm_count_alloc(size, OBJ_META_BYTES(info), zero);
+    mm_prof_count(size);
+    mm_trace(MM_TRACE_ALLOC, payload, key, size, zero);
+    return obj;
+}
+
+/* Release the memory of an object whose lock has been invalidated. */
+__INLINE
+static inline void free_object(_MMSafe_ptr_Rep obj) {
+    uint64_t info = *OBJ_INFO(obj);
+    mm_count_free(MM_INFO_SIZE(info), OBJ_META_BYTES(info));
+    mm_trace(MM_TRACE_FREE, obj.p, GET_KEY(obj.key_offset), MM_INFO_SIZE(info),
+             0);
+#ifdef MM_LOCK_TABLE
+    mm_slot_free(MM_GET_SLOT(obj.key_offset));
+#endif
+    // With deferred release turned off, a thread releases what is left in
+    // its batch on its next free.
+    size_t defer = __atomic_load_n(&mm_defer_batch, __ATOMIC_RELAXED);
+    if (__builtin_expect(defer != 0 || mm_defer_pending, 0)) {
+        if (defer == 0) {
+            mm_flush_deferred_frees();
+        } else if (!(info & MM_INLINE_TAG)) {
+            mm_defer_payload(obj.p, info);
+            return;
+        }
+    }
+    payload_free(obj.p, info);
 }
 
 //
@@ -132,29 +538,16 @@ uint32_t mm_get_new_key() {
 // Related reading: https://stackoverflow.com/questions/3523145/pointer-arithmetic-for-void-pointer-in-c
 __attribute__ ((noinline))
 for_any(T) mm_ptr<T> mm_alloc(size_t size) {
-    // We need the HEAP_PADDING to ensure that mm_ptr inside a struct
-    // is aligned by 16 bytes.
-    // See this issue for the reason: https://github.com/jzhou76/checkedc-llvm/issues/2
-    void *raw_ptr = malloc(size + HEAP_PADDING + LOCK_MEM);
-    if (raw_ptr == NULL) return NULL;
-
-    // The lock is located before the first field of the referent.
-    raw_ptr += HEAP_PADDING;
-    *((uint32_t *)(raw_ptr)) = key;
-
     // Create a helper struct to initialize the mm_ptr.
-    _MMSafe_ptr_Rep safe_ptr = { .p = raw_ptr + LOCK_MEM, .key_offset = key };
-    // Move the key to the highest 32 bits and make the offset 0.
-    safe_ptr.key_offset <<= 32;
+    _MMSafe_ptr_Rep safe_ptr = new_object(size, false);
+    if (safe_ptr.p == NULL) return NULL;
 
-    print_ptr_info("mm_alloc", safe_ptr.p, key);
+    print_ptr_info("mm_alloc", safe_ptr.p, GET_KEY(safe_ptr.key_offset));
 
 #ifdef PORTING
     insert_mmsafe_ptr(safe_ptr.p);
 #endif
 
-    key++;
-
     return *((mm_ptr<T> *)&safe_ptr);
 }
 
@@ -167,25 +560,16 @@ for_any(T) mm_ptr<T> mm_alloc(size_t size) {
 //
 __attribute__ ((noinline))
 for_any(T) mm_array_ptr<T> mm_array_alloc(size_t array_size) {
-    void *raw_ptr = malloc(array_size + LOCK_MEM + HEAP_PADDING);
-    if (raw_ptr == NULL) return NULL;
-
-    raw_ptr += HEAP_PADDING;
-    *((uint32_t *)(raw_ptr)) = key;
-
     // Create a helper struct to initialize the mm_array_ptr.
-    _MMSafe_ptr_Rep safe_ptr = { .p = raw_ptr + LOCK_MEM, .key_offset = key };
-    // Move the key to the highest 32 bits and make the offset 0.
-    safe_ptr.key_offset <<= 32;
+    _MMSafe_ptr_Rep safe_ptr = new_object(array_size, false);
+    if (safe_ptr.p == NULL) return NULL;
 
-    print_ptr_info("mm_array_alloc", safe_ptr.p, key);
+    print_ptr_info("mm_array_alloc", safe_ptr.p, GET_KEY(safe_ptr.key_offset));
 
 #ifdef PORTING
     insert_mmsafe_ptr(safe_ptr.p);
 #endif
 
-    key++;
-
     return *((mm_array_ptr<T> *)&safe_ptr);
 }
 
@@ -215,47 +599,102 @@ for_any(T) mm_array_ptr<T> mm_array_realloc(mm_array_ptr<T> p, size_t size) {
     }
 
     // Get the original raw pointer.
-    _MMSafe_ptr_Rep *safeptr_ptr = (_MMSafe_ptr_Rep *)&p;
-    void * old_raw_ptr = safeptr_ptr->p;
-    old_raw_ptr -= EXTRA_HEAP_MEM;
+    _MMSafe_ptr_Rep safe_ptr = *(_MMSafe_ptr_Rep *)&p;
+    void *old_raw_ptr = safe_ptr.p;
 
 #ifdef MM_DEBUG
-    fprintf(stdout, "[mm_array_realloc] Old raw ptr = %p, key = %u\n",
-        safeptr_ptr->p, GET_KEY(safeptr_ptr->key_offset));
+    fprintf(stdout, "[mm_array_realloc] Old raw ptr = %p, key = %llu\n",
+        old_raw_ptr, (unsigned long long)GET_KEY(safe_ptr.key_offset));
 #endif
 
     // In case realloc() reallocates the memory to a new starting address,
     // we need invalidate the old lock before calling realloc because
     // realloc may put valid data in the location of the old lock.
     // Invalidating the old lock after calling realloc may corrupt valid memory.
-    *((uint32_t *)(old_raw_ptr + HEAP_PADDING)) = 0;
+    mm_key_t *old_lock = OBJ_LOCK(safe_ptr);
+    *old_lock = 0;
+
+    // A large array is resized by remapping its pages. A heap array that
+    // grows past mm_large_threshold is copied into its own mapping once so
+    // that it can be remapped from then on.
+    uint64_t info = *OBJ_INFO(safe_ptr);
+    uint64_t old_info = info;
+    void *new_raw_ptr = NULL;
+    bool copied = false;
+    if (info & MM_LARGE_TAG) {
+        void *block = mm_large_realloc(old_raw_ptr - LARGE_HEADER,
+                                       size + LARGE_HEADER);
+        if (block != NULL) {
+            new_raw_ptr = block + LARGE_HEADER;
+            info = *(uint64_t *)block;
+        }
+    } else if (size + LARGE_HEADER >= mm_large_threshold) {
+        void *block = mm_large_alloc(size + LARGE_HEADER);
+        if (block != NULL) {
+            new_raw_ptr = block + LARGE_HEADER;
+            size_t old_size = MM_INFO_SIZE(info);
+            memcpy(new_raw_ptr, old_raw_ptr, old_size < size ? old_size : size);
+            payload_free(old_raw_ptr, info);
+            info = *(uint64_t *)block;
+        }
+        copied = true;
+    } else {
+        void *block = heap_realloc(old_raw_ptr - EXTRA_HEAP_MEM,
+                                   size + EXTRA_HEAP_MEM);
+        if (block != NULL) {
+            new_raw_ptr = block + EXTRA_HEAP_MEM;
+            // This also drops the tag of a block from the inline allocation
+            // cache, which stops being a cache block once its size changes.
+            info = MM_MAKE_INFO(size, 0);
+        }
+        copied = true;
+    }
 
-    void *new_raw_ptr = realloc(old_raw_ptr, size + EXTRA_HEAP_MEM);
-    if (new_raw_ptr == old_raw_ptr) {
+    if (new_raw_ptr == NULL) {
         /* Recover the invalidated lock */
-        *((uint32_t *)(old_raw_ptr + HEAP_PADDING)) = GET_KEY(safeptr_ptr->key_offset);
-        return p;
+        *old_lock = GET_KEY(safe_ptr.key_offset);
+        return NULL;
     }
 
-    // Allocated to a new place. We need remove the old ptr from the set.
-    print_free_info("mm_array_realloc", old_raw_ptr + EXTRA_HEAP_MEM);
+    mm_key_t key = GET_KEY(safe_ptr.key_offset);
+    if (new_raw_ptr == old_raw_ptr) {
+        __atomic_fetch_add(&realloc_stats.in_place, 1, __ATOMIC_RELAXED);
+    } else {
+        if (copied) {
+            __atomic_fetch_add(&realloc_stats.copied, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_fetch_add(&realloc_stats.remapped, 1, __ATOMIC_RELAXED);
+        }
+
+        // Allocated to a new place. We need remove the old ptr from the set.
+        print_free_info("mm_array_realloc", old_raw_ptr);
 #ifdef PORTING
-    erase_mmsafe_ptr(old_raw_ptr + EXTRA_HEAP_MEM);
+        erase_mmsafe_ptr(old_raw_ptr);
 #endif
 
-    // The new object is placed in a different location and the old one is freed.
-    new_raw_ptr += HEAP_PADDING;
-    *((uint32_t *)new_raw_ptr) = key;
-    _MMSafe_ptr_Rep safe_ptr = {.p = new_raw_ptr + LOCK_MEM, .key_offset = key};
-    safe_ptr.key_offset <<= 32;
+        // The object is placed in a different location and the old one is
+        // freed. It gets a new key; with the lock table, it keeps its slot.
+        key = next_key();
+        safe_ptr.p = new_raw_ptr;
+        safe_ptr.key_offset =
+            MM_MAKE_KEY_OFFSET(key, GET_OFFSET(safe_ptr.key_offset));
+#ifdef MM_LOCK_TABLE
+        mm_slot_table[MM_GET_SLOT(safe_ptr.key_offset)].base = new_raw_ptr;
+#endif
 
 #ifdef PORTING
-    insert_mmsafe_ptr(safe_ptr.p);
+        insert_mmsafe_ptr(safe_ptr.p);
 #endif
 
-    key++;
+        print_ptr_info("mm_array_realloc", safe_ptr.p, key);
+    }
 
-    print_ptr_info("mm_array_realloc", safe_ptr.p, key - 1);
+    *OBJ_INFO(safe_ptr) = info;
+    *OBJ_LOCK(safe_ptr) = key;
+    mm_count_realloc(MM_INFO_SIZE(old_info), size, OBJ_META_BYTES(old_info),
+                     OBJ_META_BYTES(info), new_raw_ptr != old_raw_ptr);
+    mm_trace(MM_TRACE_REALLOC, new_raw_ptr, key, size,
+             (uintptr_t)old_raw_ptr);
 
     mm_array_ptr<T> *mm_array_ptr_ptr = (mm_array_ptr<T> *)&safe_ptr;
     return *mm_array_ptr_ptr;
@@ -271,22 +710,15 @@ __attribute__ ((noinline))
 for_any(T) mm_array_ptr<T> mm_calloc(size_t nmemb, size_t size) {
     if (nmemb == 0 || size == 0) return NULL;
 
-    void *raw_ptr = calloc(1, nmemb * size + EXTRA_HEAP_MEM);
-    if (raw_ptr == NULL) return NULL;
-
-    raw_ptr += HEAP_PADDING;
-    *((uint32_t *)(raw_ptr)) = key;
     // Create a helper struct to initialize the mm_array_ptr.
-    _MMSafe_ptr_Rep safe_ptr = { .p = raw_ptr + LOCK_MEM, .key_offset = key };
-    // Move the key to the highest 32 bits and make the offset 0.
-    safe_ptr.key_offset <<= 32;
-    key++;
+    _MMSafe_ptr_Rep safe_ptr = new_object(nmemb * size, true);
+    if (safe_ptr.p == NULL) return NULL;
 
 #ifdef PORTING
     insert_mmsafe_ptr(safe_ptr.p);
 #endif
 
-    print_ptr_info("mm_calloc", safe_ptr.p, key - 1);
+    print_ptr_info("mm_calloc", safe_ptr.p, GET_KEY(safe_ptr.key_offset));
 
     return *((mm_array_ptr<T> *)&safe_ptr);
 }
@@ -297,23 +729,15 @@ for_any(T) mm_array_ptr<T> mm_calloc(size_t nmemb, size_t size) {
 // calloc() a single heap object.
 //
 for_any(T) mm_ptr<T> mm_single_calloc(size_t size) {
-    void *raw_ptr = calloc(1, size + EXTRA_HEAP_MEM);
-    if (raw_ptr == NULL) return NULL;
-
-    // The lock is located before the first field of the referent.
-    raw_ptr += HEAP_PADDING;
-    *((uint32_t *)(raw_ptr)) = key;
-    // Create a helper struct to initialize the mm_array_ptr.
-    _MMSafe_ptr_Rep safe_ptr = { .p = raw_ptr + LOCK_MEM, .key_offset = key };
-    // Move the key to the highest 32 bits and make the offset 0.
-    safe_ptr.key_offset <<= 32;
-    key++;
+    // Create a helper struct to initialize the mm_ptr.
+    _MMSafe_ptr_Rep safe_ptr = new_object(size, true);
+    if (safe_ptr.p == NULL) return NULL;
 
 #ifdef PORTING
     insert_mmsafe_ptr(safe_ptr.p);
 #endif
 
-    print_ptr_info("mm_single_calloc", safe_ptr.p, key - 1);
+    print_ptr_info("mm_single_calloc", safe_ptr.p, GET_KEY(safe_ptr.key_offset));
 
     return *((mm_ptr<T> *)&safe_ptr);
 }
@@ -325,13 +749,48 @@ for_any(T) mm_ptr<T> mm_single_calloc(size_t size) {
  * mm_array_ptr.
  * */
 mm_array_ptr<char> mm_strdup(mm_array_ptr<const char> p) {
+    return mm_strdup_len(p, NULL);
+}
+
+/*
+ * Function: mm_strdup_len().
+ *
+ * mm_strdup() that also stores the length of the string in *len (if len is
+ * not NULL), so that the caller does not have to compute it again.
+ * */
+mm_array_ptr<char> mm_strdup_len(mm_array_ptr<const char> p, size_t *len) {
     if (p == NULL) return NULL;
 
-    size_t len = strlen(_GETCHARPTR(p)) + 1;
-    mm_array_ptr<char> new_p = MM_ARRAY_ALLOC(char, len);
+    return mm_strndup_len(p, strlen(_GETCHARPTR(p)), len);
+}
+
+/*
+ * Function: mm_strndup().
+ *
+ * An mmsafe version of strndup. It copies at most n chars of the string and
+ * always NUL-terminates the copy.
+ * */
+mm_array_ptr<char> mm_strndup(mm_array_ptr<const char> p, size_t n) {
+    return mm_strndup_len(p, n, NULL);
+}
+
+/*
+ * Function: mm_strndup_len().
+ *
+ * mm_strndup() that also stores the length of the copy in *len (if len is
+ * not NULL).
+ * */
+mm_array_ptr<char> mm_strndup_len(mm_array_ptr<const char> p, size_t n,
+                                  size_t *len) {
+    if (p == NULL) return NULL;
+
+    size_t n_chars = strnlen(_GETCHARPTR(p), n);
+    mm_array_ptr<char> new_p = MM_ARRAY_ALLOC(char, n_chars + 1);
     if (new_p == NULL) return NULL;
 
-    memcpy(_GETCHARPTR(new_p), _GETCHARPTR(p), len);
+    memcpy(_GETCHARPTR(new_p), _GETCHARPTR(p), n_chars);
+    _GETCHARPTR(new_p)[n_chars] = '\0';
+    if (len != NULL) *len = n_chars;
     return new_p;
 }
 
@@ -384,28 +843,38 @@ for_any(T) void mm_free(mm_ptr<const T> const p) {
 
     // Do two temporal memory safety checks.
     // First, check if the offset is zero. A non-zero offset means an invalid free.
-    uint64_t key_offset = mm_ptr_ptr->key_offset;
-    if (GET_OFFSET(key_offset) != 0) {
+    _MMSafe_ptr_Rep obj = { mm_ptr_ptr->p, mm_ptr_ptr->key_offset };
+    uint64_t key_offset = obj.key_offset;
+    mm_key_t *lock_ptr = OBJ_LOCK(obj);
+#ifdef MM_LOCK_TABLE
+    // The base of a freed slot links the list of free slots, so a pointer
+    // to a freed object would fail the start check; leave it to the key
+    // check to report the double free.
+    if (GET_KEY(key_offset) == *lock_ptr && !IS_OBJ_START(obj)) {
+#else
+    if (!IS_OBJ_START(obj)) {
+#endif
         // An invalid free
         fprintf(stderr, "Invalid Free (non-zero offset in an mmptr).\n");
         abort();
     }
 
     // Second, do a key checking. This would catch double free or UAF errors.
-    void *lock_ptr = mm_ptr_ptr->p - LOCK_MEM;
-    if (GET_KEY(key_offset) != *(uint32_t *)lock_ptr) {
+    if (GET_KEY(key_offset) != *lock_ptr) {
         fprintf(stderr, "Double Free or Invalid Free\n");
-        fprintf(stderr, "raw ptr = %p, ", lock_ptr + LOCK_MEM);
-        fprintf(stderr, "key = %u, lock = %u\n", GET_KEY(key_offset), *(uint32_t *)lock_ptr);
+        fprintf(stderr, "raw ptr = %p, ", obj.p);
+        fprintf(stderr, "key = %llu, lock = %llu\n",
+                (unsigned long long)GET_KEY(key_offset),
+                (unsigned long long)*lock_ptr);
         abort();
     }
 
     // Invalidate the lock.
     // This step may not be necessary in some cases. In some implementation,
     // free() zeros out all bytes of the memory region of the freed object.
-    *(uint32_t *)lock_ptr = 0;
+    *lock_ptr = 0;
 
-    free(lock_ptr - HEAP_PADDING);
+    free_object(obj);
 
     print_free_info("mm_free", mm_ptr_ptr->p);
 
@@ -438,27 +907,37 @@ for_any(T) void mm_array_free(mm_array_ptr<const T> const p) {
 
     // Do two temporal memory safety checks.
     // First, check if the offset is zero. A non-zero offset means an invalid free.
-    uint64_t key_offset = mm_array_ptr_ptr->key_offset;
-    if (GET_OFFSET(key_offset) != 0) {
+    _MMSafe_ptr_Rep obj = { mm_array_ptr_ptr->p, mm_array_ptr_ptr->key_offset };
+    uint64_t key_offset = obj.key_offset;
+    mm_key_t *lock_ptr = OBJ_LOCK(obj);
+#ifdef MM_LOCK_TABLE
+    // The base of a freed slot links the list of free slots, so a pointer
+    // to a freed object would fail the start check; leave it to the key
+    // check to report the double free.
+    if (GET_KEY(key_offset) == *lock_ptr && !IS_OBJ_START(obj)) {
+#else
+    if (!IS_OBJ_START(obj)) {
+#endif
         // An invalid free
         fprintf(stderr, "Invalid Free (non-zero offset in an mmptr).\n");
         abort();
     }
 
     // Second, do a key checking. This would catch double free or UAF errors.
-    void *lock_ptr = mm_array_ptr_ptr->p - LOCK_MEM;
-    if (GET_KEY(key_offset) != *(uint32_t *)lock_ptr) {
+    if (GET_KEY(key_offset) != *lock_ptr) {
         fprintf(stderr, "Double Free or Invalid Free: ");
-        fprintf(stderr, "key = %u, lock = %u\n", GET_KEY(key_offset), *(uint32_t *)lock_ptr);
+        fprintf(stderr, "key = %llu, lock = %llu\n",
+                (unsigned long long)GET_KEY(key_offset),
+                (unsigned long long)*lock_ptr);
         abort();
     }
 
     // Invalidate the lock.
     // This step may not be necessary in some cases. In some implementation,
     // free() zeros out all bytes of the memory region of the freed object.
-    *(uint32_t *)lock_ptr = 0;
+    *lock_ptr = 0;
 
-    free(lock_ptr - HEAP_PADDING);
+    free_object(obj);
 
     print_free_info("mm_array_free", mm_array_ptr_ptr->p);
 
@@ -467,6 +946,115 @@ for_any(T) void mm_array_free(mm_array_ptr<const T> const p) {
 #endif
 }
 
+#ifndef MM_LOCK_TABLE
+/*
+ * Function: mm_inline_alloc_slow()
+ *
+ * The slow path of mm_inline_alloc(): claim new keys and refill the cache,
+ * or fall back to mm_alloc() for blocks that are too big for the cache and
+ * while tracing is on, so that the allocation is traced.
+ * */
+_MMSafe_ptr_Rep mm_inline_alloc_slow(size_t size) {
+    size_t block_size = size + EXTRA_HEAP_MEM;
+    if (block_size > MM_INLINE_MAX_BLOCK ||
+        __atomic_load_n(&mm_trace_on, __ATOMIC_RELAXED)) {
+        mm_ptr<void> p = mm_alloc<void>(size);
+        return *(_MMSafe_ptr_Rep *)&p;
+    }
+
+    unsigned cls = (block_size + 15) / 16 - 1;
+    if (mm_tcache.head[cls] == NULL) tcache_refill(cls);
+    if (mm_tcache.head[cls] == NULL) {
+        _MMSafe_ptr_Rep null_ptr = { NULL, 0 };
+        return null_ptr;
+    }
+    if (mm_thread_key == mm_thread_key_end) refill_keys();
+
+    return mm_inline_alloc(size);
+}
+
+/*
+ * Function: mm_inline_free_slow()
+ *
+ * The slow path of mm_inline_free(): free a block past a full cache to the
+ * heap, return a block to the thread that owns it, or let mm_free() report
+ * a failed check, free a block that is not from the cache, or trace the
+ * free while tracing is on.
+ * */
+void mm_inline_free_slow(_MMSafe_ptr_Rep p) {
+    void *lock_ptr = p.p - LOCK_MEM;
+    uint64_t *info = lock_ptr - HEAP_PADDING;
+    if (GET_OFFSET(p.key_offset) != 0 ||
+        GET_KEY(p.key_offset) != *(mm_key_t *)lock_ptr ||
+        !(*info & MM_INLINE_TAG) ||
+        __atomic_load_n(&mm_trace_on, __ATOMIC_RELAXED)) {
+        mm_free<void>(*(mm_ptr<void> *)&p);
+        return;
+    }
+
+    *(mm_key_t *)lock_ptr = 0;
+    tcache_free(info, MM_INFO_FLAGS(*info) >> MM_INLINE_CLASS_SHIFT);
+}
+#endif
+
+/*
+ * Function: mm_array_size()
+ *
+ * Return the size of the heap object that p points into, as it was requested
+ * from mm_alloc(), mm_array_alloc(), etc., or from the last
+ * mm_array_realloc(). p does not need to point to the start of the object.
+ * */
+for_any(T) size_t mm_array_size(mm_array_ptr<const T> p) {
+    if (p == NULL) return 0;
+
+    _MMSafe_ptr_Rep obj = obj_start(*(_MMSafe_ptr_Rep *)&p);
+    return MM_INFO_SIZE(*OBJ_INFO(obj));
+}
+
+/*
+ * Function: mm_usable_size()
+ *
+ * Return the number of bytes of the heap object that p points into that can
+ * be used without a reallocation. It is at least mm_array_size(p).
+ * */
+for_any(T) size_t mm_usable_size(mm_array_ptr<const T> p) {
+    if (p == NULL) return 0;
+
+    _MMSafe_ptr_Rep obj = obj_start(*(_MMSafe_ptr_Rep *)&p);
+    uint64_t info = *OBJ_INFO(obj);
+    if (info & MM_LARGE_TAG) return mm_large_usable_size(obj.p - LARGE_HEADER);
+    if (info & MM_INLINE_TAG) {
+        return (MM_INFO_FLAGS(info) >> MM_INLINE_CLASS_SHIFT) * 16;
+    }
+    return heap_usable_size(obj.p - EXTRA_HEAP_MEM) - EXTRA_HEAP_MEM;
+}
+
+/*
+ * Function: mm_get_realloc_stats()
+ *
+ * Report how many times mm_array_realloc() resized an object in place, moved
+ * it by remapping its pages, and moved it by copying its payload.
+ * */
+void mm_get_realloc_stats(mm_realloc_stats_t *stats) {
+    stats->in_place = __atomic_load_n(&realloc_stats.in_place, __ATOMIC_RELAXED);
+    stats->remapped = __atomic_load_n(&realloc_stats.remapped, __ATOMIC_RELAXED);
+    stats->copied = __atomic_load_n(&realloc_stats.copied, __ATOMIC_RELAXED);
+}
+
+/*
+ * Function: mm_free_raw()
+ *
+ * Invalidate the lock of an mmsafe object and release its memory, given only
+ * the raw pointer to the object. uncertain_free() of the porting library uses
+ * this when the raw pointer of an mmsafe pointer is passed to free().
+ * */
+#ifndef MM_LOCK_TABLE
+void mm_free_raw(void *p) {
+    _MMSafe_ptr_Rep obj = { p, 0 };
+    *OBJ_LOCK(obj) = 0;
+    free_object(obj);
+}
+#endif
 
 //
 // Function: _getptr_mm()
@@ -497,6 +1085,41 @@ for_any(T) void *_getptr_mm_array(mm_array_ptr<const T> const p) {
     return ((_MMSafe_ptr_Rep *)&p)->p;
 }
 
+/*
+ * Function: mm_checked() and mmarray_checked()
+ *
+ * Validate-once helpers for hot loops. They do the same key check that the
+ * compiler inserts before a dereference, once, and return the raw pointer,
+ * so that a loop over an object that nothing frees while it runs (e.g., the
+ * string copy of parson's process_string()) can go through the raw pointer
+ * without a check per access. The raw pointer is only good for as long as
+ * the checked pointer would pass the same check; it must not be kept
+ * across a call that may free the object.
+ *
+ * A NULL pointer gives NULL. Pointers to stack and global objects (keys 1
+ * and 2) have no lock to check and are returned as they are. A pointer to
+ * a freed object is a fatal error.
+ * */
+static void *validate_once(_MMSafe_ptr_Rep p, const char *fn) {
+    mm_key_t key = MM_GET_KEY(p.key_offset);
+    if (p.p == NULL || key < FIRST_VALID_KEY) return p.p;
+
+    if (__builtin_expect(*MM_LOCK_ADDR(p.p, p.key_offset) != key, 0)) {
+        fprintf(stderr, "%s(): the object at %p (key %llu) has been freed.\n",
+                fn, p.p, (unsigned long long)key);
+        abort();
+    }
+    return p.p;
+}
+
+for_any(T) void *mm_checked(mm_ptr<T> p) {
+    return validate_once(*(_MMSafe_ptr_Rep *)&p, "mm_checked");
+}
+
+for_any(T) void *mmarray_checked(mm_array_ptr<T> p) {
+    return validate_once(*(_MMSafe_ptr_Rep *)&p, "mmarray_checked");
+}
+
 
 /*
  * Function: create_invalid_mm_ptr()
@@ -572,7 +1195,8 @@ for_any(T) void _setptr_mm(mm_ptr<const T> *p, char *new_p) {
  * */
 for_any(T) void _setptr_mm_array(mm_array_ptr<const T> *p, char *new_p) {
     _MMSafe_ptr_Rep *safeptr = (_MMSafe_ptr_Rep *)p;
-    safeptr->key_offset += (new_p - (char *)(safeptr->p));
+    safeptr->key_offset = MM_ADD_OFFSET(safeptr->key_offset,
+                                        new_p - (char *)(safeptr->p));
     safeptr->p = (void *)new_p;
 }
 
@@ -599,12 +1223,108 @@ for_any(T) mm_array_ptr<T> _create_mm_array_ptr(mm_array_ptr<const T> p, char *n
     _MMSafe_ptr_Rep *base_safeptr_ptr = (_MMSafe_ptr_Rep *)&p;
     _MMSafe_ptr_Rep new_safeptr = {
         new_p,
-        base_safeptr_ptr->key_offset + (new_p - (char *)(base_safeptr_ptr->p))
+        MM_ADD_OFFSET(base_safeptr_ptr->key_offset,
+                      new_p - (char *)(base_safeptr_ptr->p))
   };
 
   return *((mm_array_ptr<T> *)&new_safeptr);
 }
 
+/*
+ * Marshaling arrays of checked pointers for unchecked code.
+ *
+ * An array of checked pointers is an array of 16-byte {raw pointer, key and
+ * offset} pairs; unchecked code wants a plain array of the raw pointers.
+ * copy_raw_lanes() extracts the raw-pointer lanes two pairs at a time with
+ * SSE2 unpacks. copy_raw_lanes_nt() does the same for a NULL-terminated
+ * array, looking for the terminator in the same pass. It reads the array
+ * in 32-byte aligned blocks, so it may read the pair after the terminator
+ * but never crosses into another page.
+ *
+ * The _to() variants write into a buffer supplied by the caller, or into a
+ * per-thread scratch buffer when buf is NULL. The scratch buffer is reused
+ * by the next _to() call on the same thread that passes a NULL buf, so its
+ * contents must be consumed before then, and it must not be freed.
+ * */
+typedef struct {
+  void *mem;
+  size_t size;
+} scratch_buf_t;
+
+/* _unmarshal_mm_ptr() has its own buffer because its input usually is the
+ * marshal scratch buffer. */
+static __thread scratch_buf_t marshal_scratch;
+static __thread scratch_buf_t unmarshal_scratch;
+
+static void *get_scratch(scratch_buf_t *buf, size_t size) {
+  if (size > buf->size) {
+    size_t new_size = buf->size ? buf->size : 256;
+    while (new_size < size) new_size *= 2;
+    void *new_mem = realloc(buf->mem, new_size);
+    if (new_mem == NULL) {
+      fprintf(stderr, "Failed to grow a marshaling scratch buffer.\n");
+      abort();
+    }
+    buf->mem = new_mem;
+    buf->size = new_size;
+  }
+  return buf->mem;
+}
+
+static void copy_raw_lanes(void **dst, const _MMSafe_ptr_Rep *src, size_t n) {
+  size_t i = 0;
+#ifdef __SSE2__
+  for (; i + 2 <= n; i += 2) {
+    __m128i a = _mm_loadu_si128((const __m128i *)&src[i]);
+    __m128i b = _mm_loadu_si128((const __m128i *)&src[i + 1]);
+    _mm_storeu_si128((__m128i *)&dst[i], _mm_unpacklo_epi64(a, b));
+  }
+#endif
+  for (; i < n; i++) {
+    dst[i] = src[i].p;
+  }
+}
+
+/* Copy the raw pointers of a NULL-terminated array, including the NULL, into
+ * dst, which has room for cap pointers. Return the number of pointers before
+ * the NULL, or cap if the array does not fit. */
+static size_t copy_raw_lanes_nt(void **dst, size_t cap,
+                                const _MMSafe_ptr_Rep *src) {
+  size_t i = 0;
+#ifdef __SSE2__
+  if (((uintptr_t)src & 15) == 0) {
+    if (((uintptr_t)src & 31) && i < cap) {
+      if ((dst[i] = src[i].p) == NULL) return i;
+      i++;
+    }
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 2 <= cap; i += 2) {
+      __m128i a = _mm_load_si128((const __m128i *)&src[i]);
+      __m128i b = _mm_load_si128((const __m128i *)&src[i + 1]);
+      __m128i lanes = _mm_unpacklo_epi64(a, b);
+      int nulls = _mm_movemask_epi8(_mm_cmpeq_epi32(lanes, zero));
+      if ((nulls & 0xff) == 0xff) {
+        dst[i] = NULL;
+        return i;
+      }
+      _mm_storeu_si128((__m128i *)&dst[i], lanes);
+      if ((nulls & 0xff00) == 0xff00) return i + 1;
+    }
+  }
+#endif
+  for (; i < cap; i++) {
+    if ((dst[i] = src[i].p) == NULL) return i;
+  }
+  return cap;
+}
+
+/* Count the pointers of a NULL-terminated array, not including the NULL. */
+static size_t count_raw_lanes_nt(const _MMSafe_ptr_Rep *src) {
+  size_t n = 0;
+  while (src[n].p != NULL) n++;
+  return n;
+}
+
 /**
  * Function: _marshal_shared_array_ptr()
  *
@@ -612,44 +1332,120 @@ for_any(T) mm_array_ptr<T> _create_mm_array_ptr(mm_array_ptr<const T> p, char *n
  * are supposed to be shared between checked and unchecked code.
  * It extracts all the raw C pointers of the array, puts them in a newly
  * allocated array of raw pointers, and returns the starting address of this
- * new array.
+ * new array. The caller owns the new array.
  *
  * Assumption: The input array of pointers ends with a NULL pointr.
  *
  * */
 for_any(T) void **_marshal_shared_array_ptr(mm_array_ptr<mm_array_ptr<T>> p) {
-  char **raw_p = *(char ***)&p;
-  unsigned size = 0;
-  /* First, compute the size of this array. */
-  while (*p++){
-    size++;
-  }
-  size++;
+  const _MMSafe_ptr_Rep *src = *(const _MMSafe_ptr_Rep **)&p;
+  size_t size = count_raw_lanes_nt(src) + 1;
 
-  /* Second, make a new array of raw pointers. */
   void **new_p = malloc(sizeof(void *) * size);
-  for (unsigned i = 0; i < size - 1; i++) {
-    /* The " * 2" in "i * 2" is to skip the metadata. */
-    new_p[i] = raw_p[i * 2];
+  if (new_p == NULL) return NULL;
+  copy_raw_lanes(new_p, src, size);
+  return new_p;
+}
+
+/*
+ * Function: _marshal_shared_array_ptr_to()
+ *
+ * Like _marshal_shared_array_ptr(), but the raw pointers go into buf, which
+ * has room for cap pointers including the terminating NULL, or into the
+ * per-thread scratch buffer if buf is NULL (cap is ignored then). Return
+ * the array of raw pointers, or NULL if it does not fit in buf.
+ * */
+for_any(T) void **_marshal_shared_array_ptr_to(mm_array_ptr<mm_array_ptr<T>> p,
+                                               void **buf, size_t cap) {
+  const _MMSafe_ptr_Rep *src = *(const _MMSafe_ptr_Rep **)&p;
+
+  if (buf != NULL) {
+    return copy_raw_lanes_nt(buf, cap, src) < cap ? buf : NULL;
   }
-  new_p[size - 1] = NULL;
 
-  return new_p;
+  // Fill what the scratch buffer already holds in a single pass, and grow
+  // it only when the array turns out to be longer.
+  buf = get_scratch(&marshal_scratch, sizeof(void *));
+  cap = marshal_scratch.size / sizeof(void *);
+  size_t n = copy_raw_lanes_nt(buf, cap, src);
+  if (n == cap) {
+    n += count_raw_lanes_nt(src + cap);
+    buf = get_scratch(&marshal_scratch, sizeof(void *) * (n + 1));
+    copy_raw_lanes(buf + cap, src + cap, n + 1 - cap);
+  }
+  return buf;
 }
 
 /*
  * Function: _marshal_mm_ptr()
  *
- * Marshal an array of size number of mm_ptr.
+ * Marshal an array of size number of mm_ptr into a newly allocated array of
+ * raw pointers. The caller owns the new array.
  * */
 for_any(T) void **_marshal_mm_ptr(mm_array_ptr<mm_ptr<T>> p, size_t size) {
-  char **raw_p = *(char ***)&p;
+  void **new_p = malloc(sizeof(void *) * size);
+  if (new_p == NULL) return NULL;
+  copy_raw_lanes(new_p, *(const _MMSafe_ptr_Rep **)&p, size);
+  return new_p;
+}
+
+/*
+ * Function: _marshal_mm_ptr_to()
+ *
+ * Like _marshal_mm_ptr(), but the raw pointers go into buf, which must have
+ * room for n pointers, or into the per-thread scratch buffer if buf is NULL.
+ * */
+for_any(T) void **_marshal_mm_ptr_to(mm_array_ptr<mm_ptr<T>> p, size_t n,
+                                     void **buf) {
+  if (buf == NULL) buf = get_scratch(&marshal_scratch, sizeof(void *) * n);
+  copy_raw_lanes(buf, *(const _MMSafe_ptr_Rep **)&p, n);
+  return buf;
+}
 
-  void **new_p = malloc(sizeof(void*) * size);
-  for (unsigned i = 0; i < size; i++) {
-    new_p[i] = raw_p[i * 2];
+static int compare_raw_ptr(const void *p1, const void *p2) {
+  uintptr_t a = *(const uintptr_t *)p1;
+  uintptr_t b = *(const uintptr_t *)p2;
+  return (a > b) - (a < b);
+}
+
+/*
+ * Function: _unmarshal_mm_ptr()
+ *
+ * The reverse of _marshal_mm_ptr() for arrays that unchecked code has
+ * reordered, e.g., with qsort(): put the n mm_ptr of p in the order of the
+ * n raw pointers of raw. raw must be a permutation of the raw pointers of p.
+ * It takes O(n log n) time, using the per-thread scratch buffer.
+ * */
+for_any(T) void _unmarshal_mm_ptr(mm_array_ptr<mm_ptr<T>> p, size_t n,
+                                  void **raw) {
+  _MMSafe_ptr_Rep *elems = *(_MMSafe_ptr_Rep **)&p;
+  if (n == 0) return;
+
+  // Sort a copy of the pointers by address, then look each raw pointer up
+  // in it to get its metadata back.
+  _MMSafe_ptr_Rep *sorted =
+    get_scratch(&unmarshal_scratch, sizeof(_MMSafe_ptr_Rep) * n);
+  memcpy(sorted, elems, sizeof(_MMSafe_ptr_Rep) * n);
+  _MMSafe_ptr_Rep sorted_ptr = { sorted, 0 };
+  mm_qsort(*(mm_array_ptr<mm_ptr<void>> *)&sorted_ptr, n, sizeof(void *),
+           compare_raw_ptr);
+
+  for (size_t i = 0; i < n; i++) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if ((uintptr_t)sorted[mid].p < (uintptr_t)raw[i]) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo == n || sorted[lo].p != raw[i]) {
+      fprintf(stderr, "_unmarshal_mm_ptr(): %p is not in the array.\n", raw[i]);
+      abort();
+    }
+    elems[i] = sorted[lo];
   }
-  return new_p;
 }
 
 /* Duplicate a string on the heap and return an mm_array_ptr<char> to it.*/
@@ -8,6 +8,17 @@
 # Load the common paths and variables.
 . common.sh
 
+#
+# "inline" (e.g., "./cmake-ts.sh inline" or "./cmake-ts.sh lto inline") turns
+# on the header-inline allocation fast path of libsafemm. It has a build
+# directory of its own, so that Olden can run with the fast path on and off
+# ("./olden.sh inline" and "./olden.sh checked").
+#
+if [[ $1 == "inline" || $2 == "inline" ]]; then
+    CFLAGS="-DMM_INLINE_ALLOC $CFLAGS"
+    TESTSUITE_BUILD_DIR="$TESTS_DIR/ts-build-inline"
+fi
+
 # Go to the build directory. Create one if it does not exist.
 [[ -d $TESTSUITE_BUILD_DIR ]] || mkdir -p $TESTSUITE_BUILD_DIR
 cd "$TESTSUITE_BUILD_DIR"
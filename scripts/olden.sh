@@ -84,7 +84,7 @@ usage() {
     echo "Usage: "
     echo "  ./olden.sh [target] [benchmark] | clean"
     echo
-    echo "  target: baseline, checked, or cets"
+    echo "  target: baseline, checked, inline, or cets"
     echo "  benchmark: Olden benchmark. If no benchmark name is given, all benchmarks will run."
     echo "  \"clean\" removes exsiting binaries"
     exit
@@ -106,6 +106,12 @@ main() {
             DATA_DIR="$DATA_DIR/olden/checked"
             LIT="$LLVM_BIN_DIR/llvm-lit"
             ;;
+        inline)
+            # Checked, with the header-inline allocation fast path.
+            BUILD_DIR="$TESTS_DIR/ts-build-inline"
+            DATA_DIR="$DATA_DIR/olden/inline"
+            LIT="$LLVM_BIN_DIR/llvm-lit"
+            ;;
         cets)
             BUILD_DIR="$TESTS_DIR/ts-build-cets"
             DATA_DIR="$DATA_DIR/olden/cets"
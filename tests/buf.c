@@ -0,0 +1,158 @@
+/*
+ * Tests of growable checked buffers (mm_buf_t) and of the printf functions
+ * that format into checked arrays.
+ * */
+
+#include "debug.h"
+#include <string.h>
+
+/*
+ * f0(): Appending grows the buffer and keeps its contents NUL-terminated.
+ * */
+void f0() {
+    print_start("appending to a buffer");
+
+    mm_buf_t buf;
+    mm_buf_init(&buf);
+    for (int i = 0; i < 1000; i++) {
+        if (mm_buf_appendf(&buf, "%d,", i % 10) != 0) {
+            print_error("buf.c::f0(): appendf failed");
+            break;
+        }
+    }
+    if (buf.len != 2000 || buf.cap <= buf.len || buf.data[buf.len] != '\0' ||
+        strncmp(_GETCHARPTR(buf.data), "0,1,2,", 6) != 0) {
+        print_error("buf.c::f0(): wrong contents");
+    }
+
+    mm_array_ptr<char> s = mm_strdup_from_raw("abc");
+    mm_buf_reset(&buf);
+    mm_buf_append_str(&buf, s);
+    mm_buf_append(&buf, s, 1);
+    mm_buf_putc(&buf, '!');
+    if (strcmp(_GETCHARPTR(buf.data), "abca!") != 0) {
+        print_error("buf.c::f0(): wrong contents after reset");
+    }
+
+    mm_buf_shrink(&buf);
+    if (buf.cap != buf.len + 1) {
+        print_error("buf.c::f0(): shrink did not shrink");
+    }
+
+    mm_array_free<char>(s);
+    mm_buf_free(&buf);
+
+    print_end("appending to a buffer");
+}
+
+/*
+ * f1(): A detached buffer is a regular heap array. A pointer into the
+ * buffer from before it grew into a new block fails its check.
+ * */
+void f1() {
+    print_start("detaching a buffer");
+
+    signal(SIGILL, ill_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    mm_buf_t buf;
+    mm_buf_init(&buf);
+    mm_buf_appendf(&buf, "%s", "hello");
+    mm_array_ptr<char> old = buf.data;
+    // Big enough for a block of its own, so the buffer has to move.
+    mm_buf_reserve(&buf, 4 << 20);
+
+    size_t len;
+    mm_array_ptr<char> s = mm_buf_detach(&buf, &len);
+    if (len != 5 || strcmp(_GETCHARPTR(s), "hello") != 0 || buf.data != NULL) {
+        print_error("buf.c::f1(): wrong detached contents");
+    }
+    mm_array_free<char>(s);
+
+    // There should be a "illegal instruction" for the next line.
+    old[0] = 'j';
+    print_error("buf.c::f1(): testing UAF of a moved buffer failed");
+
+resume:
+    print_end("detaching a buffer");
+}
+
+/*
+ * f2(): mm_snprintf() formats into a checked array, and mm_asprintf() into a
+ * new array of the right size.
+ * */
+void f2() {
+    print_start("printf into checked arrays");
+
+    mm_array_ptr<char> s = MM_ARRAY_ALLOC(char, 16);
+    if (mm_snprintf(s, 16, "%s=%d", "key", 42) != 6 ||
+        strcmp(_GETCHARPTR(s), "key=42") != 0) {
+        print_error("buf.c::f2(): wrong mm_snprintf output");
+    }
+    if (mm_snprintf(s + 8, 8, "%d", 123456789) != 9 ||
+        strcmp(_GETCHARPTR(s + 8), "1234567") != 0) {
+        print_error("buf.c::f2(): mm_snprintf did not truncate");
+    }
+
+    mm_array_ptr<char> a = NULL;
+    if (mm_asprintf(&a, "%s-%s", "left", "right") != 10 ||
+        strcmp(_GETCHARPTR(a), "left-right") != 0 ||
+        mm_array_size<char>(a) != 11) {
+        print_error("buf.c::f2(): wrong mm_asprintf output");
+    }
+
+    mm_array_free<char>(s);
+    mm_array_free<char>(a);
+
+    print_end("printf into checked arrays");
+}
+
+/* mm_snprintf() aborts instead of trapping; come back to the test. */
+static void abrt_handler(int sig) {
+    signal(SIGABRT, SIG_DFL);
+    longjmp(resume_context, 1);
+}
+
+/*
+ * f3(): mm_snprintf() aborts when its destination points past the end of
+ * its array, or is NULL with a non-zero size.
+ * */
+void f3() {
+    print_start("printf past the end of a checked array");
+
+    mm_array_ptr<char> s = MM_ARRAY_ALLOC(char, 16);
+
+    signal(SIGABRT, abrt_handler);
+    if (setjmp(resume_context) == 1) goto null_dst;
+
+    // There should be an abort for the next line.
+    mm_snprintf(s + 20, 4, "%d", 1);
+    print_error("buf.c::f3(): testing a destination past the end failed");
+
+null_dst:
+    signal(SIGABRT, abrt_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    // There should be an abort for the next line.
+    mm_snprintf(NULL, 4, "%d", 1);
+    print_error("buf.c::f3(): testing a NULL destination failed");
+
+resume:
+    mm_array_free<char>(s);
+    print_end("printf past the end of a checked array");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    f2();
+
+    f3();
+
+    print_main_end(__FILE__);
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Tests of the validate-once helpers: mm_checked() and mmarray_checked().
+ * */
+
+#include "debug.h"
+
+/* mmarray_checked() aborts instead of trapping; come back to the test. */
+static void abrt_handler(int sig) {
+    signal(SIGABRT, SIG_DFL);
+    longjmp(resume_context, 1);
+}
+
+/*
+ * f0(): The helpers return the raw pointer of a live object, including
+ * through an interior pointer, and NULL for NULL.
+ * */
+void f0() {
+    print_start("raw pointers of live objects");
+
+    mm_array_ptr<int> p = mm_array_alloc<int>(sizeof(int) * 100);
+    int *raw = MM_ARRAY_CHECKED(int, p);
+    if (raw != _GETARRAYPTR(int, p)) {
+        print_error("checked.c::f0(): raw pointer of an array");
+    }
+    for (int i = 0; i < 100; i++) raw[i] = i;
+    if (p[99] != 99) {
+        print_error("checked.c::f0(): write through the raw pointer");
+    }
+    if (MM_ARRAY_CHECKED(int, p + 50) != raw + 50) {
+        print_error("checked.c::f0(): raw pointer through an interior pointer");
+    }
+
+    mm_ptr<Node> node = MM_ALLOC(Node);
+    Node *n = MM_CHECKED(Node, node);
+    n->val = 7;
+    if (node->val != 7) {
+        print_error("checked.c::f0(): raw pointer of a struct");
+    }
+
+    if (MM_ARRAY_CHECKED(int, NULL) != NULL) {
+        print_error("checked.c::f0(): raw pointer of NULL");
+    }
+
+    mm_array_free<int>(p);
+    MM_FREE(Node, node);
+
+    print_end("raw pointers of live objects");
+}
+
+/*
+ * f1(): Asking for the raw pointer of a freed object aborts.
+ * */
+void f1() {
+    print_start("raw pointer of a freed object");
+
+    signal(SIGABRT, abrt_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    mm_array_ptr<char> p = mm_array_alloc<char>(64);
+    mm_array_free<char>(p);
+
+    // There should be an abort for the next line.
+    MM_ARRAY_CHECKED(char, p);
+    print_error("checked.c::f1(): testing a freed object failed");
+
+resume:
+    print_end("raw pointer of a freed object");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    print_main_end(__FILE__);
+    return 0;
+}
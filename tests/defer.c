@@ -0,0 +1,147 @@
+/*
+ * Tests of deferred release of freed objects (mm_defer_free()).
+ * */
+
+#include "debug.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Objects of this size get their own mapping (see lib/mm_large.c). */
+#define LARGE_SIZE (1 << 20)
+#define NUM_LARGE 20
+
+/* Whether the memory of a freed large object has been released, i.e., its
+ * mapping is gone. */
+static int released(char *raw) {
+    return msync(raw, 1, MS_ASYNC) != 0;
+}
+
+static void free_large(char **raw, int n) {
+    for (int i = 0; i < n; i++) {
+        mm_array_ptr<char> p = mm_array_alloc<char>(LARGE_SIZE);
+        p[0] = 'a';
+        raw[i] = _GETCHARPTR(p);
+        mm_array_free<char>(p);
+    }
+}
+
+/*
+ * f0(): With deferred release, a freed object is invalidated right away,
+ * even though its memory is not released yet.
+ * */
+void f0() {
+    print_start("use after a deferred free");
+
+    signal(SIGILL, ill_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    mm_defer_free(64, 0);
+    mm_array_ptr<char> p = mm_array_alloc<char>(4000);
+    p[0] = 'a';
+    mm_array_free<char>(p);
+
+    // There should be a "illegal instruction" for the next line.
+    p[0] = 'b';
+    print_error("defer.c::f0(): testing UAF after a deferred free failed");
+
+resume:
+    mm_defer_free(0, 0);
+    print_end("use after a deferred free");
+}
+
+/*
+ * f1(): Objects freed in background mode are all released, including the
+ * ones in a batch that is not full yet.
+ * */
+void f1() {
+    print_start("batches released in the background");
+
+    char *raw[NUM_LARGE];
+    mm_defer_free(16, 1);
+    free_large(raw, NUM_LARGE);
+    mm_flush_deferred_frees();
+    mm_defer_free(0, 0);
+
+    // The releaser thread releases the full batch when it gets to it.
+    int left = NUM_LARGE;
+    for (int tries = 0; tries < 1000 && left > 0; tries++) {
+        left = 0;
+        for (int i = 0; i < NUM_LARGE; i++) left += !released(raw[i]);
+        if (left > 0) usleep(1000);
+    }
+    if (left > 0) {
+        print_error("defer.c::f1(): some objects were not released");
+    }
+
+    mm_array_ptr<char> q = mm_array_alloc<char>(100);
+    q[99] = 'z';
+    if (q[99] != 'z') {
+        print_error("defer.c::f1(): allocation after deferred frees failed");
+    }
+    mm_array_free<char>(q);
+
+    print_end("batches released in the background");
+}
+
+/* How far free_after_off() and f2() have got. */
+static int stage;
+
+static void wait_for_stage(int n) {
+    while (__atomic_load_n(&stage, __ATOMIC_ACQUIRE) != n) usleep(100);
+}
+
+static void *free_after_off(void *arg) {
+    int *failed = arg;
+    char *raw[4];
+
+    free_large(raw, 4);
+    for (int i = 0; i < 4; i++) {
+        if (released(raw[i])) *failed = 1;
+    }
+    __atomic_store_n(&stage, 1, __ATOMIC_RELEASE);
+    // The main thread turns deferred release off here.
+    wait_for_stage(2);
+
+    mm_array_ptr<char> p = mm_array_alloc<char>(100);
+    mm_array_free<char>(p);
+    for (int i = 0; i < 4; i++) {
+        if (!released(raw[i])) *failed = 1;
+    }
+    return NULL;
+}
+
+/*
+ * f2(): After deferred release is turned off, another thread releases the
+ * objects left in its batch on its next free.
+ * */
+void f2() {
+    print_start("batches of other threads after turning it off");
+
+    int failed = 0;
+    pthread_t thread;
+    mm_defer_free(16, 0);
+    pthread_create(&thread, NULL, free_after_off, &failed);
+    wait_for_stage(1);
+    mm_defer_free(0, 0);
+    __atomic_store_n(&stage, 2, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    if (failed) {
+        print_error("defer.c::f2(): a leftover batch was not released");
+    }
+
+    print_end("batches of other threads after turning it off");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    f2();
+
+    print_main_end(__FILE__);
+    return 0;
+}
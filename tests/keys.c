@@ -0,0 +1,104 @@
+/*
+ * Tests of the per-thread blocks of keys.
+ * */
+
+#include "debug.h"
+#include <pthread.h>
+
+#define NUM_THREADS 4
+/* More than the keys of a few key blocks (4096 keys each) per thread. */
+#define KEYS_PER_THREAD (3 * 4096 + 100)
+
+static uint64_t keys[NUM_THREADS][KEYS_PER_THREAD];
+static mm_ptr<Node> freed_node;
+
+static uint64_t key_of(mm_array_ptr<char> p) {
+    return MM_GET_KEY(((_MMSafe_ptr_Rep *)&p)->key_offset);
+}
+
+static int by_value(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void *alloc_keys(void *arg) {
+    uint64_t *mine = arg;
+    for (int i = 0; i < KEYS_PER_THREAD; i++) {
+        mm_array_ptr<char> p = mm_array_alloc<char>(16 + i % 64);
+        mine[i] = key_of(p);
+        mm_array_free<char>(p);
+    }
+    return NULL;
+}
+
+/*
+ * f0(): Threads that go through several key blocks each never hand out
+ * the same key twice, nor one of the reserved keys 0, 1, and 2.
+ * */
+void f0() {
+    print_start("unique keys across threads");
+
+    pthread_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, alloc_keys, keys[i]);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    uint64_t *all = &keys[0][0];
+    size_t n = NUM_THREADS * KEYS_PER_THREAD;
+    qsort(all, n, sizeof(uint64_t), by_value);
+    for (size_t i = 0; i < n; i++) {
+        if (all[i] < 3) {
+            print_error("keys.c::f0(): a reserved key was handed out");
+            break;
+        }
+        if (i > 0 && all[i] == all[i - 1]) {
+            print_error("keys.c::f0(): a key was handed out twice");
+            break;
+        }
+    }
+
+    print_end("unique keys across threads");
+}
+
+static void *alloc_and_free(void *arg) {
+    freed_node = MM_ALLOC(Node);
+    freed_node->val = 1;
+    MM_FREE(Node, freed_node);
+    return NULL;
+}
+
+/*
+ * f1(): An object that another thread allocated and freed fails its check
+ * in this thread.
+ * */
+void f1() {
+    print_start("UAF of another thread's object");
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, alloc_and_free, NULL);
+    pthread_join(thread, NULL);
+
+    signal(SIGILL, ill_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    // There should be a "illegal instruction" for the next line.
+    freed_node->val = 2;
+    print_error("keys.c::f1(): testing UAF of another thread's object failed");
+
+resume:
+    print_end("UAF of another thread's object");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    print_main_end(__FILE__);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Tests of marshaling arrays of mmsafe pointers into caller buffers and the
+ * per-thread scratch buffer, and of unmarshaling them.
+ * */
+
+#include "debug.h"
+#include <pthread.h>
+
+#define NUM_STRS 1000
+#define NUM_NODES 1000
+
+/* A NULL-terminated array of n strings. */
+static mm_array_ptr<mm_array_ptr<char>> make_strs(size_t n) {
+    mm_array_ptr<mm_array_ptr<char>> strs =
+        MM_ARRAY_ALLOC(mm_array_ptr<char>, n + 1);
+    for (size_t i = 0; i < n; i++) {
+        strs[i] = MM_ARRAY_ALLOC(char, 16);
+        mm_snprintf(strs[i], 16, "str%zu", i);
+    }
+    strs[n] = NULL;
+    return strs;
+}
+
+static void free_strs(mm_array_ptr<mm_array_ptr<char>> strs, size_t n) {
+    for (size_t i = 0; i < n; i++) MM_ARRAY_FREE(char, strs[i]);
+    MM_ARRAY_FREE(mm_array_ptr<char>, strs);
+}
+
+/* Whether raw holds the n raw pointers of strs and a NULL after them. */
+static int same_ptrs(void **raw, mm_array_ptr<mm_array_ptr<char>> strs,
+                     size_t n) {
+    if (raw == NULL) return 0;
+    for (size_t i = 0; i < n; i++) {
+        if (raw[i] != _GETCHARPTR(strs[i])) return 0;
+    }
+    return raw[n] == NULL;
+}
+
+/*
+ * f0(): A NULL-terminated array goes into a caller buffer that has room for
+ * it and its NULL, and not into one that is a slot too small.
+ * */
+void f0() {
+    print_start("marshaling into a caller buffer");
+
+    void *buf[34];
+    for (size_t n = 0; n < 34; n++) {
+        mm_array_ptr<mm_array_ptr<char>> strs = make_strs(n);
+        if (!same_ptrs(_marshal_shared_array_ptr_to<char>(strs, buf, n + 1),
+                       strs, n)) {
+            print_error("marshal.c::f0(): an array that fits");
+        }
+        if (_marshal_shared_array_ptr_to<char>(strs, buf, n) != NULL) {
+            print_error("marshal.c::f0(): an array that does not fit");
+        }
+        free_strs(strs, n);
+    }
+
+    print_end("marshaling into a caller buffer");
+}
+
+static void *marshal_to_scratch(void *arg) {
+    int *failed = arg;
+
+    // The scratch buffer of a new thread has room for a few pointers only,
+    // so the long array has to grow it after the first pass.
+    mm_array_ptr<mm_array_ptr<char>> shorter = make_strs(3);
+    mm_array_ptr<mm_array_ptr<char>> longer = make_strs(NUM_STRS);
+    void **raw = _marshal_shared_array_ptr_to<char>(shorter, NULL, 0);
+    if (!same_ptrs(raw, shorter, 3)) *failed = 1;
+    raw = _marshal_shared_array_ptr_to<char>(longer, NULL, 0);
+    if (!same_ptrs(raw, longer, NUM_STRS)) *failed = 1;
+    // Then a short array reuses the grown buffer.
+    if (_marshal_shared_array_ptr_to<char>(shorter, NULL, 0) != raw ||
+        !same_ptrs(raw, shorter, 3)) {
+        *failed = 1;
+    }
+
+    free_strs(shorter, 3);
+    free_strs(longer, NUM_STRS);
+    return NULL;
+}
+
+/*
+ * f1(): An array that is longer than the scratch buffer grows it, and all
+ * of its pointers make it there.
+ * */
+void f1() {
+    print_start("marshaling into the scratch buffer");
+
+    int failed = 0;
+    pthread_t thread;
+    pthread_create(&thread, NULL, marshal_to_scratch, &failed);
+    pthread_join(thread, NULL);
+    if (failed) {
+        print_error("marshal.c::f1(): the scratch buffer has wrong pointers");
+    }
+
+    print_end("marshaling into the scratch buffer");
+}
+
+static int node_cmp(const void *p1, const void *p2) {
+    Node *n1 = *(Node **)p1;
+    Node *n2 = *(Node **)p2;
+    return (n1->val > n2->val) - (n1->val < n2->val);
+}
+
+/*
+ * f2(): After unchecked code sorts the raw pointers from
+ * _marshal_mm_ptr_to(), _unmarshal_mm_ptr() puts the checked pointers in
+ * the same order, each with its own metadata.
+ * */
+void f2() {
+    print_start("unmarshaling after qsort()");
+
+    mm_array_ptr<mm_ptr<Node>> nodes =
+        mm_array_alloc<mm_ptr<Node>>(sizeof(mm_ptr<Node>) * NUM_NODES);
+    for (int i = 0; i < NUM_NODES; i++) {
+        nodes[i] = MM_ALLOC(Node);
+        nodes[i]->val = (i * 7919) % NUM_NODES;
+    }
+
+    void **raw = _marshal_mm_ptr_to<Node>(nodes, NUM_NODES, NULL);
+    qsort(raw, NUM_NODES, sizeof(void *), node_cmp);
+    _unmarshal_mm_ptr<Node>(nodes, NUM_NODES, raw);
+
+    for (int i = 0; i < NUM_NODES; i++) {
+        if (nodes[i]->val != i) {
+            print_error("marshal.c::f2(): the array is not sorted");
+            break;
+        }
+    }
+
+    // A pointer with the metadata of another object would fail its check
+    // when it is freed.
+    for (int i = 0; i < NUM_NODES - 1; i++) {
+        MM_FREE(Node, nodes[i]);
+    }
+
+    signal(SIGILL, ill_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    // There should be a "illegal instruction" for the next line.
+    nodes[0]->val = 0;
+    print_error("marshal.c::f2(): testing UAF of an unmarshaled pointer "
+                "failed");
+
+resume:
+    MM_FREE(Node, nodes[NUM_NODES - 1]);
+    mm_array_free<mm_ptr<Node>>(nodes);
+    print_end("unmarshaling after qsort()");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    f2();
+
+    print_main_end(__FILE__);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Tests of recycling pools: mm_pool_get() and mm_pool_put().
+ * */
+
+#include "debug.h"
+
+/*
+ * f0(): An object put back into a pool is handed out again by the next get,
+ * with a new key.
+ * */
+void f0() {
+    print_start("recycling an object");
+
+    mm_pool_t *pool = MM_POOL_CREATE(Node);
+    mm_ptr<Node> n0 = MM_POOL_GET(Node, pool);
+    n0->val = 1;
+    void *raw = _getptr_mm<Node>(n0);
+    MM_POOL_PUT(Node, pool, n0);
+
+    mm_ptr<Node> n1 = MM_POOL_GET(Node, pool);
+    if (_getptr_mm<Node>(n1) != raw) {
+        print_error("pool.c::f0(): the object was not recycled");
+    }
+    if (_GETKEY(&n1) == _GETKEY(&n0)) {
+        print_error("pool.c::f0(): the recycled object has its old key");
+    }
+    n1->val = 2;
+
+    mm_pool_stats_t stats;
+    mm_pool_get_stats(pool, &stats);
+    if (stats.hits != 1 || stats.misses != 1 || stats.puts != 1) {
+        print_error("pool.c::f0(): wrong pool stats");
+    }
+
+    MM_POOL_PUT(Node, pool, n1);
+    mm_pool_destroy(pool);
+
+    print_end("recycling an object");
+}
+
+/*
+ * f1(): A stale pointer to a recycled object fails its check.
+ * */
+void f1() {
+    print_start("UAF of a recycled object");
+
+    signal(SIGILL, ill_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    mm_pool_t *pool = MM_POOL_CREATE(Node);
+    mm_ptr<Node> n0 = MM_POOL_GET(Node, pool);
+    MM_POOL_PUT(Node, pool, n0);
+    mm_ptr<Node> n1 = MM_POOL_GET(Node, pool);
+    n1->val = 1;
+
+    // There should be a "illegal instruction" for the next line.
+    n0->val = 2;
+    print_error("pool.c::f1(): testing UAF of a recycled object failed");
+
+resume:
+    print_end("UAF of a recycled object");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    print_main_end(__FILE__);
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Tests of vectors of mmsafe pointers (mm_ptr_vec_t).
+ * */
+
+#include <string.h>
+
+#include "debug.h"
+
+/* Out-of-bounds indexes and checks of freed objects abort instead of
+ * trapping; come back to the test. */
+static void abrt_handler(int sig) {
+    signal(SIGABRT, SIG_DFL);
+    longjmp(resume_context, 1);
+}
+
+/*
+ * f0(): Elements read back as the pointers that were pushed, and the raw
+ * array is NULL-terminated and points to the same objects.
+ * */
+void f0() {
+    print_start("push, get, and the raw array");
+
+    mm_ptr_vec_t vec;
+    mm_ptr_vec_init(&vec);
+    if (mm_ptr_vec_raw(&vec)[0] != NULL) {
+        print_error("ptr_vec.c::f0(): raw array of an empty vector");
+    }
+
+    mm_array_ptr<char> strs[100];
+    for (int i = 0; i < 100; i++) {
+        strs[i] = mm_array_alloc<char>(16);
+        mm_snprintf(strs[i], 16, "arg%d", i);
+        if (mm_ptr_vec_push<char>(&vec, strs[i]) != 0) {
+            print_error("ptr_vec.c::f0(): push failed");
+        }
+    }
+
+    char **raw = (char **)mm_ptr_vec_raw(&vec);
+    if (vec.len != 100 || raw[100] != NULL || strcmp(raw[42], "arg42") != 0) {
+        print_error("ptr_vec.c::f0(): raw array");
+    }
+    mm_array_ptr<char> p = mm_ptr_vec_get<char>(&vec, 7);
+    if (p != strs[7] || p[3] != '7') {
+        print_error("ptr_vec.c::f0(): get");
+    }
+    if (mm_ptr_vec_checked(&vec, 9) != _GETCHARPTR(strs[9])) {
+        print_error("ptr_vec.c::f0(): raw pointer of an element");
+    }
+    mm_ptr_vec_set<char>(&vec, 3, strs[4]);
+    if (raw[3] != raw[4]) {
+        print_error("ptr_vec.c::f0(): set");
+    }
+
+    int count = 0;
+    mm_array_ptr<char> s = NULL;
+    MM_PTR_VEC_FOREACH(char, &vec, i, s) {
+        if (s[0] == 'a') count++;
+    }
+    if (count != 100) {
+        print_error("ptr_vec.c::f0(): iteration");
+    }
+    mm_ptr_vec_check(&vec);
+
+    for (int i = 0; i < 100; i++) mm_array_free<char>(strs[i]);
+    mm_ptr_vec_free(&vec);
+
+    print_end("push, get, and the raw array");
+}
+
+/*
+ * f1(): An element that points to a freed object is still caught: through
+ * the pointer from mm_ptr_vec_get(), and by mm_ptr_vec_check().
+ * */
+void f1() {
+    print_start("elements that point to freed objects");
+
+    mm_ptr_vec_t vec;
+    mm_ptr_vec_init(&vec);
+    mm_array_ptr<char> p = mm_array_alloc<char>(16);
+    mm_ptr_vec_push<char>(&vec, p);
+    mm_array_free<char>(p);
+
+    signal(SIGILL, ill_handler);
+    if (setjmp(resume_context) == 1) goto check;
+
+    mm_array_ptr<char> q = mm_ptr_vec_get<char>(&vec, 0);
+    // There should be a "illegal instruction" for the next line.
+    q[0] = 'a';
+    print_error("ptr_vec.c::f1(): testing UAF through an element failed");
+
+check:
+    signal(SIGABRT, abrt_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    // There should be an abort for the next line.
+    mm_ptr_vec_check(&vec);
+    print_error("ptr_vec.c::f1(): checking a freed element failed");
+
+resume:
+    mm_ptr_vec_free(&vec);
+    print_end("elements that point to freed objects");
+}
+
+/*
+ * f2(): An index out of bounds aborts.
+ * */
+void f2() {
+    print_start("index out of bounds");
+
+    mm_ptr_vec_t vec;
+    mm_ptr_vec_init(&vec);
+    mm_array_ptr<char> p = mm_array_alloc<char>(16);
+    mm_ptr_vec_push<char>(&vec, p);
+
+    signal(SIGABRT, abrt_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    // There should be an abort for the next line.
+    mm_ptr_vec_get<char>(&vec, 1);
+    print_error("ptr_vec.c::f2(): testing an index out of bounds failed");
+
+resume:
+    mm_array_free<char>(p);
+    mm_ptr_vec_free(&vec);
+    print_end("index out of bounds");
+}
+
+/*
+ * f3(): Pushing or setting a NULL element aborts, so that the raw array is
+ * not cut short.
+ * */
+void f3() {
+    print_start("NULL elements");
+
+    mm_ptr_vec_t vec;
+    mm_ptr_vec_init(&vec);
+    mm_array_ptr<char> p = mm_array_alloc<char>(16);
+    mm_ptr_vec_push<char>(&vec, p);
+
+    signal(SIGABRT, abrt_handler);
+    if (setjmp(resume_context) == 1) goto set;
+
+    // There should be an abort for the next line.
+    mm_ptr_vec_push<char>(&vec, NULL);
+    print_error("ptr_vec.c::f3(): testing a NULL push failed");
+
+set:
+    signal(SIGABRT, abrt_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    // There should be an abort for the next line.
+    mm_ptr_vec_set<char>(&vec, 0, NULL);
+    print_error("ptr_vec.c::f3(): testing a NULL set failed");
+
+resume:
+    if (vec.len != 1 || mm_ptr_vec_raw(&vec)[0] != _GETCHARPTR(p)) {
+        print_error("ptr_vec.c::f3(): a NULL element changed the vector");
+    }
+    mm_array_free<char>(p);
+    mm_ptr_vec_free(&vec);
+    print_end("NULL elements");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    f2();
+
+    f3();
+
+    print_main_end(__FILE__);
+    return 0;
+}
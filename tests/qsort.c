@@ -0,0 +1,101 @@
+/*
+ * Tests of sorting and searching arrays of mm_ptr: mm_qsort() and
+ * mm_bsearch().
+ * */
+
+#include "debug.h"
+
+#define NUM_NODES 1000
+
+static int node_cmp(const void *p1, const void *p2) {
+    Node *n1 = *(Node **)p1;
+    Node *n2 = *(Node **)p2;
+    return (n1->val > n2->val) - (n1->val < n2->val);
+}
+
+static int key_cmp(const void *key, const void *p) {
+    int val = *(const int *)key;
+    Node *n = *(Node **)p;
+    return (val > n->val) - (val < n->val);
+}
+
+/*
+ * f0(): mm_qsort() sorts the array in place and moves the metadata of every
+ * element along with its raw pointer, so the sorted pointers can still be
+ * dereferenced and freed.
+ * */
+void f0() {
+    print_start("mm_qsort");
+
+    mm_array_ptr<mm_ptr<Node>> nodes =
+        mm_array_alloc<mm_ptr<Node>>(sizeof(mm_ptr<Node>) * NUM_NODES);
+    for (int i = 0; i < NUM_NODES; i++) {
+        nodes[i] = MM_ALLOC(Node);
+        nodes[i]->val = (i * 7919) % NUM_NODES;
+    }
+
+    mm_qsort((mm_array_ptr<mm_ptr<void>>)nodes, NUM_NODES, sizeof(Node *),
+             node_cmp);
+
+    for (int i = 0; i < NUM_NODES; i++) {
+        if (nodes[i]->val != i) {
+            print_error("qsort.c::f0(): the array is not sorted");
+            break;
+        }
+    }
+
+    for (int i = 0; i < NUM_NODES; i++) {
+        MM_FREE(Node, nodes[i]);
+    }
+    mm_array_free<mm_ptr<Node>>(nodes);
+
+    print_end("mm_qsort");
+}
+
+/*
+ * f1(): mm_bsearch() returns a checked pointer to the matching element of a
+ * sorted array, or NULL if there is none.
+ * */
+void f1() {
+    print_start("mm_bsearch");
+
+    mm_array_ptr<mm_ptr<Node>> nodes =
+        mm_array_alloc<mm_ptr<Node>>(sizeof(mm_ptr<Node>) * NUM_NODES);
+    for (int i = 0; i < NUM_NODES; i++) {
+        nodes[i] = MM_ALLOC(Node);
+        nodes[i]->val = i * 2;
+    }
+
+    for (int key = 0; key < NUM_NODES * 2; key++) {
+        mm_array_ptr<mm_ptr<Node>> found = (mm_array_ptr<mm_ptr<Node>>)
+            mm_bsearch(&key, (mm_array_ptr<mm_ptr<void>>)nodes, NUM_NODES,
+                       sizeof(Node *), key_cmp);
+        if (key % 2 == 0) {
+            if (found == NULL || (*found)->val != key) {
+                print_error("qsort.c::f1(): an element was not found");
+                break;
+            }
+        } else if (found != NULL) {
+            print_error("qsort.c::f1(): found an element that is not there");
+            break;
+        }
+    }
+
+    for (int i = 0; i < NUM_NODES; i++) {
+        MM_FREE(Node, nodes[i]);
+    }
+    mm_array_free<mm_ptr<Node>>(nodes);
+
+    print_end("mm_bsearch");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    print_main_end(__FILE__);
+    return 0;
+}
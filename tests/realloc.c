@@ -0,0 +1,110 @@
+/*
+ * Tests of mm_array_realloc() on large arrays, which are resized by
+ * remapping their pages.
+ * */
+
+#include "debug.h"
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MB (1 << 20)
+
+/* Check that the first n bytes of p still hold the pattern fill() wrote. */
+static int intact(mm_array_ptr<char> p, size_t n) {
+    char *raw = _GETCHARPTR(p);
+    for (size_t i = 0; i < n; i += 4096) {
+        if (raw[i] != (char)(i / 4096)) return 0;
+    }
+    return 1;
+}
+
+static void fill(mm_array_ptr<char> p, size_t from, size_t n) {
+    char *raw = _GETCHARPTR(p);
+    for (size_t i = (from + 4095) / 4096 * 4096; i < n; i += 4096) {
+        raw[i] = (char)(i / 4096);
+    }
+}
+
+/*
+ * f0(): A large array that grows within its pages stays in place, and one
+ * that cannot grow in place is moved; its payload survives, and the old
+ * pointer fails its check.
+ * */
+void f0() {
+    print_start("growing a large array");
+
+    mm_realloc_stats_t start, resized, moved, grown;
+    mm_get_realloc_stats(&start);
+
+    size_t size = 4 * MB - 1000;
+    mm_array_ptr<char> p = mm_array_alloc<char>(size);
+    fill(p, 0, size);
+
+    // Still within the pages of the mapping.
+    mm_array_ptr<char> q = mm_array_realloc<char>(p, 4 * MB - 100);
+    mm_get_realloc_stats(&resized);
+    if (_GETCHARPTR(q) != _GETCHARPTR(p) ||
+        resized.in_place != start.in_place + 1) {
+        print_error("realloc.c::f0(): no in-place resize");
+    }
+    p = q;
+    size = 4 * MB - 100;
+
+    // Take the page right after the mapping, so that it has to move. If
+    // the page is taken already, it has to move all the same.
+    char *end = _GETCHARPTR(p) + mm_usable_size<char>(p);
+    void *blocker = mmap(end, 4096, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
+                         -1, 0);
+    mm_array_ptr<char> old = p;
+    p = mm_array_realloc<char>(p, 8 * MB);
+    fill(p, size, 8 * MB);
+    size = 8 * MB;
+    mm_get_realloc_stats(&moved);
+    if (_GETCHARPTR(p) == _GETCHARPTR(old) ||
+        moved.remapped != resized.remapped + 1 ||
+        moved.copied != resized.copied) {
+        print_error("realloc.c::f0(): the array was not moved by remapping");
+    }
+    if (blocker != MAP_FAILED) munmap(blocker, 4096);
+
+    for (size_t grow = 16 * MB; grow <= 64 * MB; grow *= 2) {
+        p = mm_array_realloc<char>(p, grow);
+        if (!intact(p, size)) {
+            print_error("realloc.c::f0(): the payload did not survive");
+            break;
+        }
+        fill(p, size, grow);
+        size = grow;
+    }
+    mm_get_realloc_stats(&grown);
+    if (grown.in_place + grown.remapped !=
+        moved.in_place + moved.remapped + 3) {
+        print_error("realloc.c::f0(): wrong resize counters");
+    }
+
+    signal(SIGILL, ill_handler);
+    signal(SIGSEGV, segv_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    // There should be a "illegal instruction" or a segfault for the next
+    // line: the old mapping is gone.
+    old[0] = 'a';
+    print_error("realloc.c::f0(): testing the pointer from before a move "
+                "failed");
+
+resume:
+    signal(SIGSEGV, SIG_DFL);
+    mm_array_free<char>(p);
+    print_end("growing a large array");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    print_main_end(__FILE__);
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * Tests of regions: mm_region_alloc() and mm_region_destroy().
+ * */
+
+#include "debug.h"
+
+/*
+ * f0(): Build a list in a region and read it back.
+ * */
+void f0() {
+    print_start("allocating from a region");
+
+    mm_region_t *region = mm_region_create(0);
+    mm_ptr<Node> head = NULL;
+    for (int i = 0; i < 10000; i++) {
+        mm_ptr<Node> node = MM_REGION_ALLOC(Node, region);
+        node->val = i;
+        node->next = head;
+        head = node;
+    }
+
+    mm_array_ptr<int> array = MM_REGION_ARRAY_ALLOC(int, region, 100000);
+    for (int i = 0; i < 100000; i++) array[i] = i;
+
+    int i = 9999;
+    for (mm_ptr<Node> node = head; node != NULL; node = node->next) {
+        if (node->val != i--) {
+            print_error("region.c::f0(): wrong value in a list node");
+        }
+    }
+    for (int i = 0; i < 100000; i++) {
+        if (array[i] != i) print_error("region.c::f0(): wrong array value");
+    }
+
+    mm_region_destroy(region);
+
+    print_end("allocating from a region");
+}
+
+/*
+ * f1(): Destroying a region invalidates the pointers into it.
+ * */
+void f1() {
+    print_start("UAF of a region object");
+
+    signal(SIGILL, ill_handler);
+    signal(SIGSEGV, segv_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    mm_region_t *region = mm_region_create(0);
+    mm_ptr<Node> n0 = MM_REGION_ALLOC(Node, region);
+    mm_ptr<Node> n1 = MM_REGION_ALLOC(Node, region);
+    n0->val = 0;
+    n1->val = 1;
+    mm_region_destroy(region);
+
+    // There should be a "illegal instruction" for the next line.
+    n1->val = 2;
+    print_error("region.c::f1(): testing UAF of a region object failed");
+
+resume:
+    print_end("UAF of a region object");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    print_main_end(__FILE__);
+    return 0;
+}
@@ -15,22 +15,67 @@ SRC=(
     "addressof"
     # "checkable"
     "stack_global"
+    "size"
+    "pool"
+    "region"
+    "qsort"
+    "strview"
+    "buf"
+    "tcache"
+    "defer"
+    "checked"
+    "ptr_vec"
+    "keys"
+    "realloc"
+    "marshal"
+    "slab"
+)
+
+#
+# The variants of libsafemm that the whole suite runs against. Set SAFEMM to
+# run against one of them only. SAFEMM=safemm_locktable is the only way to
+# run against the lock table variant: it needs a compiler that emits lock
+# table lookups for the checks, and the checks that the compiler emits now
+# read the lock at p - offset - 8, which traps on every dereference there.
+#
+LIBS=(
+    "safemm"
+    "safemm_slab"
+)
+
+#
+# Tests of features that a variant does not have. The lock table variant
+# has no per-thread cache of free blocks.
+#
+declare -A SKIP=(
+    ["safemm_locktable"]="tcache"
 )
 
 #
 # Entrance of this script
 #
+if [[ -n $SAFEMM ]]; then
+    LIBS=("$SAFEMM")
+fi
+
 if [[ $# == 1 ]]; then
     # Compile and run one test file.
-    make $1
+    make $1 SAFEMM=${LIBS[0]}
     echo "Running test on $1"
     ./$1
 else
     # compile and run all the regression testing files
-    make rt
-    for src in ${SRC[@]}; do
-        echo "Running test on $src"
-        ./$src
+    for lib in ${LIBS[@]}; do
+        echo "Running tests against lib$lib"
+        make rt SAFEMM=$lib
+        for src in ${SRC[@]}; do
+            if [[ " ${SKIP[$lib]} " == *" $src "* ]]; then
+                echo "Skipping $src for lib$lib"
+                continue
+            fi
+            echo "Running test on $src"
+            ./$src
+        done
     done
 fi
 
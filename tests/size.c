@@ -0,0 +1,79 @@
+/*
+ * Tests of the size queries on heap objects: mm_array_size() and
+ * mm_usable_size().
+ * */
+
+#include "debug.h"
+
+/*
+ * f0(): The size of an object is the size requested when it was allocated,
+ * no matter where in the object the pointer points to.
+ * */
+void f0() {
+    print_start("size of an allocated object");
+
+    mm_array_ptr<int> p = mm_array_alloc<int>(sizeof(int) * 10);
+    if (mm_array_size<int>(p) != sizeof(int) * 10) {
+        print_error("size.c::f0(): size of an array");
+    }
+    if (mm_usable_size<int>(p) < sizeof(int) * 10) {
+        print_error("size.c::f0(): usable size of an array");
+    }
+    if (mm_array_size<int>(p + 7) != sizeof(int) * 10) {
+        print_error("size.c::f0(): size through an interior pointer");
+    }
+
+    mm_ptr<Node> node = MM_ALLOC(Node);
+    if (mm_array_size<Node>(mmptr_to_mmarrayptr<Node>(node)) != sizeof(Node)) {
+        print_error("size.c::f0(): size of a struct");
+    }
+
+    mm_array_ptr<char> big = mm_calloc<char>(4 << 20, sizeof(char));
+    if (mm_array_size<char>(big) != 4 << 20) {
+        print_error("size.c::f0(): size of a large array");
+    }
+
+    if (mm_array_size<int>(NULL) != 0 || mm_usable_size<int>(NULL) != 0) {
+        print_error("size.c::f0(): size of NULL");
+    }
+
+    mm_array_free<int>(p);
+    MM_FREE(Node, node);
+    mm_array_free<char>(big);
+
+    print_end("size of an allocated object");
+}
+
+/*
+ * f1(): mm_array_realloc() updates the size of an object, whether it is
+ * resized in place or moved.
+ * */
+void f1() {
+    print_start("size after realloc");
+
+    mm_array_ptr<char> p = mm_array_alloc<char>(100);
+    size_t sizes[] = { 50, 3000, 8, 2 << 20, 3 << 20, 1000 };
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        p = mm_array_realloc<char>(p, sizes[i]);
+        if (mm_array_size<char>(p) != sizes[i]) {
+            print_error("size.c::f1(): size after realloc");
+        }
+        if (mm_usable_size<char>(p) < sizes[i]) {
+            print_error("size.c::f1(): usable size after realloc");
+        }
+    }
+    mm_array_free<char>(p);
+
+    print_end("size after realloc");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    print_main_end(__FILE__);
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Tests of objects of every size class of the slab allocator
+ * (libsafemm_slab). They pass with the malloc-backed libsafemm too.
+ * */
+
+#include "debug.h"
+#include <string.h>
+
+/* The biggest block of the slab allocator; bigger ones come from malloc(). */
+#define MAX_SMALL_SIZE (32 * 1024)
+/* Every size class is at least 16 bytes wide, so stepping the payload size
+ * by 16 reaches all the classes that an object (with its header) can be in. */
+#define SIZE_STEP 16
+
+/*
+ * f0(): Objects of every size class hold their whole payload without
+ * overlapping another object of the same size, and a freed one fails its
+ * check.
+ * */
+void f0() {
+    print_start("objects of every size class");
+
+    signal(SIGILL, ill_handler);
+    for (size_t size = 1; size <= MAX_SMALL_SIZE; size += SIZE_STEP) {
+        if (setjmp(resume_context) == 1) continue;
+
+        mm_array_ptr<char> p = mm_array_alloc<char>(size);
+        mm_array_ptr<char> q = mm_array_alloc<char>(size);
+        if (p == NULL || q == NULL) {
+            print_error("slab.c::f0(): allocation failed");
+        }
+        if (mm_usable_size<char>(p) < size) {
+            print_error("slab.c::f0(): usable size is too small");
+        }
+        char *a = _GETCHARPTR(p), *b = _GETCHARPTR(q);
+        if (a < b + size && b < a + size) {
+            print_error("slab.c::f0(): two objects overlap");
+        }
+        memset(a, 'a', size);
+        memset(b, 'b', size);
+        if (a[0] != 'a' || a[size - 1] != 'a') {
+            print_error("slab.c::f0(): the payload was overwritten");
+        }
+        mm_array_free<char>(q);
+        mm_array_free<char>(p);
+
+        // There should be a "illegal instruction" for the next line.
+        p[0] = 'c';
+        print_error("slab.c::f0(): testing UAF of a freed object failed");
+    }
+
+    print_end("objects of every size class");
+}
+
+/*
+ * f1(): A freed block is handed out again, to an object of the same size
+ * class, and the pointer to the old object fails its check.
+ * */
+void f1() {
+    print_start("reusing freed blocks");
+
+    signal(SIGILL, ill_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    mm_array_ptr<char> old = mm_array_alloc<char>(1000);
+    char *raw = _GETCHARPTR(old);
+    mm_array_free<char>(old);
+
+    int reused = 0;
+    mm_array_ptr<char> objs[64];
+    for (int i = 0; i < 64; i++) {
+        objs[i] = mm_array_alloc<char>(1000);
+        if (_GETCHARPTR(objs[i]) == raw) reused = 1;
+    }
+    for (int i = 0; i < 64; i++) mm_array_free<char>(objs[i]);
+    if (!reused) {
+        print_error("slab.c::f1(): the freed block was not reused");
+    }
+
+    // There should be a "illegal instruction" for the next line.
+    old[0] = 'a';
+    print_error("slab.c::f1(): testing UAF of a reused block failed");
+
+resume:
+    print_end("reusing freed blocks");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    print_main_end(__FILE__);
+    return 0;
+}
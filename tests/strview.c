@@ -0,0 +1,169 @@
+/*
+ * Tests of checked string views (mm_strview), the tokenizer over checked
+ * buffers, and the mm_strdup() variants that return the length of the copy.
+ * */
+
+#include "debug.h"
+#include <string.h>
+
+/*
+ * f0(): Searching and comparing views, including views that are not
+ * NUL-terminated.
+ * */
+void f0() {
+    print_start("find and compare");
+
+    mm_array_ptr<char> host = mm_strdup_from_raw("www.Example.com");
+    mm_strview sv = mm_sv(host);
+    if (sv.len != 15) {
+        print_error("strview.c::f0(): wrong length");
+    }
+    if (mm_sv_find(sv, mm_sv_n(host + 4, 7)) != 4 ||
+        mm_sv_find_char(sv, '.') != 3 || mm_sv_rfind_char(sv, '.') != 11 ||
+        mm_sv_find_char(sv, '#') != MM_SV_NPOS) {
+        print_error("strview.c::f0(): wrong find result");
+    }
+
+    mm_array_ptr<char> domain = mm_strdup_from_raw("example.COM");
+    mm_strview tail = mm_sv_sub(sv, sv.len - 11, 11);
+    if (!mm_sv_caseeq(tail, mm_sv(domain)) || mm_sv_eq(tail, mm_sv(domain))) {
+        print_error("strview.c::f0(): wrong comparison result");
+    }
+    if (!mm_sv_ends_with(sv, mm_sv_n(domain + 7, 0)) ||
+        !mm_sv_starts_with(sv, mm_sv_n(host, 3)) ||
+        mm_sv_cmp(mm_sv_n(host, 3), sv) >= 0) {
+        print_error("strview.c::f0(): wrong prefix or suffix result");
+    }
+
+    // The views are compared over all their chars, past an embedded NUL.
+    mm_array_ptr<char> x = mm_array_alloc<char>(3);
+    mm_array_ptr<char> y = mm_array_alloc<char>(3);
+    memcpy(_GETCHARPTR(x), "a\0b", 3);
+    memcpy(_GETCHARPTR(y), "A\0c", 3);
+    if (mm_sv_caseeq(mm_sv_n(x, 3), mm_sv_n(y, 3)) ||
+        mm_sv_casecmp(mm_sv_n(x, 3), mm_sv_n(y, 3)) >= 0 ||
+        !mm_sv_caseeq(mm_sv_n(x, 2), mm_sv_n(y, 2))) {
+        print_error("strview.c::f0(): wrong comparison past a NUL");
+    }
+
+    mm_array_free<char>(host);
+    mm_array_free<char>(domain);
+    mm_array_free<char>(x);
+    mm_array_free<char>(y);
+
+    print_end("find and compare");
+}
+
+/*
+ * f1(): Tokenizing a view leaves the string alone, and numbers are converted
+ * without reading past the end of the view.
+ * */
+void f1() {
+    print_start("tokenize and convert");
+
+    mm_array_ptr<char> s = mm_strdup_from_raw(",,12,, 345 ,6789");
+    mm_strview rest = mm_sv_n(s, 12);
+    mm_strview tok;
+    long vals[2];
+    int n = 0;
+    while (mm_sv_tok(&rest, ", ", &tok)) {
+        if (n == 2 || mm_sv_to_long(tok, 10, &vals[n]) != tok.len) {
+            print_error("strview.c::f1(): wrong token");
+            break;
+        }
+        n++;
+    }
+    if (n != 2 || vals[0] != 12 || vals[1] != 345) {
+        print_error("strview.c::f1(): wrong tokens");
+    }
+    if (strcmp(_GETCHARPTR(s), ",,12,, 345 ,6789") != 0) {
+        print_error("strview.c::f1(): the string was modified");
+    }
+
+    mm_array_free<char>(s);
+
+    print_end("tokenize and convert");
+}
+
+/*
+ * f2(): mm_strdup_len() and mm_strndup_len() return the length of the copy.
+ * */
+void f2() {
+    print_start("strdup with length");
+
+    mm_array_ptr<char> s = mm_strdup_from_raw("hello world");
+    size_t len = 0;
+    mm_array_ptr<char> d = mm_strdup_len(s, &len);
+    if (len != 11 || strcmp(_GETCHARPTR(d), "hello world") != 0) {
+        print_error("strview.c::f2(): wrong strdup copy");
+    }
+    mm_array_ptr<char> nd = mm_strndup_len(s, 5, &len);
+    if (len != 5 || strcmp(_GETCHARPTR(nd), "hello") != 0) {
+        print_error("strview.c::f2(): wrong strndup copy");
+    }
+
+    mm_array_free<char>(s);
+    mm_array_free<char>(d);
+    mm_array_free<char>(nd);
+
+    print_end("strdup with length");
+}
+
+/*
+ * f3(): The tokenizer returns checked slices of the input without writing
+ * to it, and tokenizers over different strings do not interfere.
+ * */
+void f3() {
+    print_start("tokenizer");
+
+    mm_array_ptr<char> line = mm_strdup_from_raw("GET  /index.html HTTP/1.1");
+    mm_array_ptr<char> path = mm_strdup_from_raw("a/bb//ccc");
+    mm_tokenizer_t t0, t1;
+    mm_tok_init(&t0, line, mm_strlen(line), " ");
+    mm_tok_init(&t1, path, mm_strlen(path), "/");
+
+    size_t len0, len1;
+    mm_array_ptr<char> w0 = mm_tok_next(&t0, &len0);
+    mm_array_ptr<char> w1 = mm_tok_next(&t1, &len1);
+    if (len0 != 3 || mm_strncmp(w0, "GET", 3) != 0 ||
+        len1 != 1 || w1[0] != 'a') {
+        print_error("strview.c::f3(): wrong first tokens");
+    }
+    w0 = mm_tok_next(&t0, &len0);
+    if (len0 != 11 || mm_strncmp(w0, "/index.html", 11) != 0) {
+        print_error("strview.c::f3(): wrong second token");
+    }
+    // Writing through a slice writes to the original buffer.
+    w0[0] = '_';
+    w0 = mm_tok_next(&t0, &len0);
+    if (len0 != 8 || mm_tok_next(&t0, &len0) != NULL ||
+        strcmp(_GETCHARPTR(line), "GET  _index.html HTTP/1.1") != 0) {
+        print_error("strview.c::f3(): wrong last token");
+    }
+
+    int n = 1;
+    while (mm_tok_next(&t1, &len1) != NULL) n++;
+    if (n != 3 || len1 != 3) {
+        print_error("strview.c::f3(): wrong number of tokens");
+    }
+
+    mm_array_free<char>(line);
+    mm_array_free<char>(path);
+
+    print_end("tokenizer");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    f2();
+
+    f3();
+
+    print_main_end(__FILE__);
+    return 0;
+}
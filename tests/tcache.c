@@ -0,0 +1,93 @@
+/*
+ * Tests of the per-thread cache of free blocks that backs small objects.
+ * */
+
+#include "debug.h"
+#include <pthread.h>
+
+#define NUM_OBJS 100
+
+/*
+ * f0(): A freed small object is recycled for the next object of the same
+ * size, and a dangling pointer to the old object fails its check.
+ * */
+void f0() {
+    print_start("recycling a freed block");
+
+    signal(SIGILL, ill_handler);
+    if (setjmp(resume_context) == 1) goto resume;
+
+    mm_ptr<Node> old = MM_ALLOC(Node);
+    old->val = 1;
+    void *raw = _getptr_mm<Node>(old);
+    MM_FREE(Node, old);
+
+    mm_ptr<Node> node = MM_SINGLE_CALLOC(Node);
+    if (_getptr_mm<Node>(node) != raw) {
+        print_error("tcache.c::f0(): the freed block was not reused");
+    }
+    if (node->val != 0) {
+        print_error("tcache.c::f0(): a calloc'ed object is not zeroed");
+    }
+
+    // There should be a "illegal instruction" for the next line.
+    old->val = 2;
+    print_error("tcache.c::f0(): testing UAF of a recycled block failed");
+
+resume:
+    print_end("recycling a freed block");
+}
+
+static mm_array_ptr<char> objs[NUM_OBJS];
+
+static void *free_objs(void *arg) {
+    for (int i = 0; i < NUM_OBJS; i++) {
+        mm_array_free<char>(objs[i]);
+    }
+    return NULL;
+}
+
+/*
+ * f1(): Blocks that another thread frees go back to the thread that
+ * allocated them.
+ * */
+void f1() {
+    print_start("freeing blocks of another thread");
+
+    void *raw[NUM_OBJS];
+    for (int i = 0; i < NUM_OBJS; i++) {
+        objs[i] = mm_array_alloc<char>(40);
+        raw[i] = _getptr_mm_array<char>(objs[i]);
+    }
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, free_objs, NULL);
+    pthread_join(thread, NULL);
+
+#if MM_TCACHE_OWNERS
+    // The blocks come back once the cache runs out of other blocks.
+    int found = 0;
+    for (int i = 0; i < MM_INLINE_CACHE_LIMIT + NUM_OBJS; i++) {
+        mm_array_ptr<char> p = mm_array_alloc<char>(40);
+        for (int j = 0; j < NUM_OBJS; j++) {
+            if (_getptr_mm_array<char>(p) == raw[j]) found++;
+        }
+    }
+    if (found != NUM_OBJS) {
+        print_error("tcache.c::f1(): the blocks did not come back");
+    }
+#endif
+
+    print_end("freeing blocks of another thread");
+}
+
+int main(int argc, char *argv[]) {
+    print_main_start(__FILE__);
+
+    f0();
+
+    f1();
+
+    print_main_end(__FILE__);
+    return 0;
+}